@@ -1,8 +1,31 @@
 #include "include/whisper.h"
+#include "include/ggml-cpu.h"
 #include <moonbit.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STUB_X86 1
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 // Helper: MoonBit Bytes -> C string (NULL-terminated)
 static char* bytes_to_cstring(moonbit_bytes_t bytes) {
@@ -13,222 +36,3866 @@ static char* bytes_to_cstring(moonbit_bytes_t bytes) {
     return str;
 }
 
-// Helper: C string -> MoonBit Bytes
-static moonbit_bytes_t cstring_to_bytes(const char* str) {
-    if (str == NULL) {
-        return moonbit_make_bytes(0, 0);
+// Helper: C string -> MoonBit Bytes
+static moonbit_bytes_t cstring_to_bytes(const char* str) {
+    if (str == NULL) {
+        return moonbit_make_bytes(0, 0);
+    }
+    int len = (int)strlen(str);
+    moonbit_bytes_t result = moonbit_make_bytes(len, 0);
+    memcpy(result, str, len);
+    return result;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+// --- Context management ---
+
+struct whisper_context* whisper_ctx_init(moonbit_bytes_t model_path) {
+    char* path = bytes_to_cstring(model_path);
+    struct whisper_context_params cparams = whisper_context_default_params();
+    struct whisper_context* ctx = whisper_init_from_file_with_params(path, cparams);
+    free(path);
+    return ctx;
+}
+
+// Model weights only; inference needs a whisper_state from whisper_state_init.
+struct whisper_context* whisper_ctx_init_no_state(moonbit_bytes_t model_path) {
+    char* path = bytes_to_cstring(model_path);
+    struct whisper_context_params cparams = whisper_context_default_params();
+    struct whisper_context* ctx = whisper_init_from_file_with_params_no_state(path, cparams);
+    free(path);
+    return ctx;
+}
+
+// --- File identity ---
+//
+// Device, inode, size and mtime: enough to tell that a path now names a
+// replaced file.
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+} file_id_t;
+
+static int64_t stat_mtime_ns(const struct stat* st) {
+#if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+static file_id_t file_id_of(const struct stat* st) {
+    file_id_t id = {st->st_dev, st->st_ino, st->st_size, stat_mtime_ns(st)};
+    return id;
+}
+
+static int file_id_equal(const file_id_t* a, const file_id_t* b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size && a->mtime_ns == b->mtime_ns;
+}
+
+// --- Context params (heap-allocated) ---
+//
+// Starts from whisper_context_default_params(). Custom DTW alignment heads are
+// copied into storage owned by the params object; whisper keeps pointing at
+// them to build each new state, so the params must outlive the context. The
+// params also record the load statistics of the context loaded with them.
+
+typedef struct {
+    double load_ms;  // whole whisper_init* call
+    int timed;       // read_ms / read_bytes were measured
+    double read_ms;  // inside the loader's read callback
+    int64_t read_bytes;
+    int scanned;     // weight_* filled in (or the file could not be read)
+    int64_t weight_bytes[GGML_TYPE_COUNT];
+    int32_t weight_tensors[GGML_TYPE_COUNT];
+} load_stats_t;
+
+typedef struct {
+    struct whisper_context_params params;
+    whisper_ahead* heads;
+    int timed;          // load through the timed loader (not a whisper param)
+    char* model_path;   // file the context was loaded from, for the weight scan
+    file_id_t model_id;  // and which file that path named then
+    load_stats_t stats;
+} cparams_owned_t;
+
+struct whisper_context_params* whisper_cparams_create(void) {
+    cparams_owned_t* o = (cparams_owned_t*)calloc(1, sizeof(cparams_owned_t));
+    o->params = whisper_context_default_params();
+    return &o->params;
+}
+
+void whisper_cparams_free(struct whisper_context_params* p) {
+    if (p != NULL) {
+        cparams_owned_t* o = (cparams_owned_t*)p;
+        free(o->heads);
+        free(o->model_path);
+        free(o);
+    }
+}
+
+int32_t whisper_cparams_is_null(struct whisper_context_params* p) {
+    return p == NULL ? 1 : 0;
+}
+
+void whisper_cparams_set_timed_load(struct whisper_context_params* p, int32_t val) {
+    ((cparams_owned_t*)p)->timed = val != 0;
+}
+
+void whisper_cparams_set_use_gpu(struct whisper_context_params* p, int32_t val) {
+    p->use_gpu = val != 0;
+}
+
+void whisper_cparams_set_flash_attn(struct whisper_context_params* p, int32_t val) {
+    p->flash_attn = val != 0;
+}
+
+void whisper_cparams_set_gpu_device(struct whisper_context_params* p, int32_t val) {
+    p->gpu_device = val;
+}
+
+void whisper_cparams_set_dtw_token_timestamps(struct whisper_context_params* p, int32_t val) {
+    p->dtw_token_timestamps = val != 0;
+}
+
+void whisper_cparams_set_dtw_aheads_preset(struct whisper_context_params* p, int32_t val) {
+    p->dtw_aheads_preset = (enum whisper_alignment_heads_preset)val;
+}
+
+void whisper_cparams_set_dtw_n_top(struct whisper_context_params* p, int32_t val) {
+    p->dtw_n_top = val;
+}
+
+void whisper_cparams_set_dtw_mem_size(struct whisper_context_params* p, int64_t val) {
+    p->dtw_mem_size = val < 0 ? 0 : (size_t)val;
+}
+
+// `pairs` is a MoonBit FixedArray[Int] of (n_text_layer, n_head) pairs.
+// Returns 0, or -1 on allocation failure (the previous heads are kept).
+int32_t whisper_cparams_set_dtw_aheads(struct whisper_context_params* p, int32_t* pairs) {
+    cparams_owned_t* o = (cparams_owned_t*)p;
+    size_t n = (size_t)Moonbit_array_length(pairs) / 2;
+    whisper_ahead* heads = NULL;
+    if (n > 0) {
+        heads = (whisper_ahead*)malloc(n * sizeof(whisper_ahead));
+        if (!heads) return -1;
+        for (size_t i = 0; i < n; i++) {
+            heads[i].n_text_layer = pairs[2 * i];
+            heads[i].n_head = pairs[2 * i + 1];
+        }
+    }
+    free(o->heads);
+    o->heads = heads;
+    p->dtw_aheads.n_heads = n;
+    p->dtw_aheads.heads = heads;
+    return 0;
+}
+
+int32_t whisper_ctx_is_null(struct whisper_context* ctx) {
+    return ctx == NULL ? 1 : 0;
+}
+
+void whisper_ctx_free(struct whisper_context* ctx) {
+    if (ctx != NULL) {
+        whisper_free(ctx);
+    }
+}
+
+// --- Params management (heap-allocated) ---
+//
+// whisper_full_params only points at the language, prompts and VAD model
+// path, so each params object owns copies of them, freed in
+// whisper_params_free.
+// Separate params objects share no state and may be set up and used from
+// different threads at once; one params object may also be used by several
+// concurrent whisper_full* calls as long as nobody calls a setter meanwhile.
+// `params` is the first member, so the handle MoonBit holds is both a
+// whisper_full_params* and a params_owned_t*.
+
+typedef struct {
+    struct whisper_full_params params;
+    char* language;
+    char* initial_prompt;
+    whisper_token* prompt_tokens;
+    char* vad_model_path;
+} params_owned_t;
+
+struct whisper_full_params* whisper_params_create(void) {
+    params_owned_t* o = (params_owned_t*)calloc(1, sizeof(params_owned_t));
+    struct whisper_full_params* p = &o->params;
+    *p = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    // Disable noisy output by default
+    p->print_progress = false;
+    p->print_realtime = false;
+    p->print_special = false;
+    p->print_timestamps = false;
+    return p;
+}
+
+// Replace one of the strings owned by a params object with `value` (already
+// a private heap copy); the previous copy is freed, which is why setters must
+// not race with a running whisper_full.
+static const char* params_set_string(char** slot, char* value) {
+    free(*slot);
+    *slot = value;
+    return *slot;
+}
+
+// Plain C halves of the string setters; they touch no MoonBit objects, so
+// native threads can fill params through them.
+static void params_set_language_cstr(struct whisper_full_params* p, const char* lang) {
+    p->language = params_set_string(&((params_owned_t*)p)->language, strdup(lang));
+}
+
+static void params_set_initial_prompt_cstr(struct whisper_full_params* p, const char* prompt) {
+    p->initial_prompt = params_set_string(&((params_owned_t*)p)->initial_prompt, strdup(prompt));
+}
+
+static void params_set_vad_model_path_cstr(struct whisper_full_params* p, const char* path) {
+    p->vad_model_path = params_set_string(&((params_owned_t*)p)->vad_model_path, strdup(path));
+}
+
+void whisper_params_set_language(struct whisper_full_params* p, moonbit_bytes_t lang) {
+    p->language = params_set_string(&((params_owned_t*)p)->language, bytes_to_cstring(lang));
+}
+
+void whisper_params_set_translate(struct whisper_full_params* p, int32_t translate) {
+    p->translate = translate != 0;
+}
+
+void whisper_params_set_n_threads(struct whisper_full_params* p, int32_t n_threads) {
+    p->n_threads = n_threads;
+}
+
+void whisper_params_free(struct whisper_full_params* p) {
+    if (p != NULL) {
+        params_owned_t* o = (params_owned_t*)p;
+        free(o->language);
+        free(o->initial_prompt);
+        free(o->prompt_tokens);
+        free(o->vad_model_path);
+        free(o);
+    }
+}
+
+// --- Per-call callbacks ---
+//
+// One params object may serve several runs at once, so callbacks are never
+// set on it: whisper_params_hook makes a per-call copy (sharing the base's
+// strings, so the base must outlive it) that any whisper_run_* /
+// whisper_state_run_* function accepts in its place. Setters and
+// whisper_params_free must not be used on the copy; free it with
+// whisper_params_unhook. The MoonBit closures are called on the thread
+// running whisper_full, so only hook runs made from the MoonBit thread;
+// whisper_full_parallel drops them for its extra workers.
+//
+// Stopping is native instead: abort_callback is polled by ggml between graph
+// nodes, on worker threads too, and encoder_begin_callback before each 30 s
+// window. Both only read `stop` and the clock.
+
+enum {
+    HOOK_STOP_NONE = 0,
+    HOOK_STOP_CANCELLED = 1,
+    HOOK_STOP_DEADLINE = 2,
+};
+
+typedef struct {
+    struct whisper_full_params params;
+    void (*on_segment)(void* closure, int32_t n_new);
+    void* on_segment_closure;
+    void (*on_progress)(void* closure, int32_t percent);
+    void* on_progress_closure;
+    double deadline;  // now_ms() clock, 0 = none
+    int32_t stop;     // HOOK_STOP_*, accessed atomically
+} params_hooked_t;
+
+struct whisper_full_params* whisper_params_hook(struct whisper_full_params* base) {
+    if (!base) return NULL;
+    params_hooked_t* h = (params_hooked_t*)calloc(1, sizeof(params_hooked_t));
+    if (!h) return NULL;
+    h->params = *base;
+    return &h->params;
+}
+
+static void hook_new_segment(struct whisper_context* ctx, struct whisper_state* state, int n_new, void* user_data) {
+    params_hooked_t* h = (params_hooked_t*)user_data;
+    moonbit_incref(h->on_segment_closure);  // the callee consumes its argument
+    h->on_segment(h->on_segment_closure, n_new);
+}
+
+// Call `call(closure, n_new)` whenever whisper finalizes n_new segments;
+// they are the last n_new of the run's segments so far. Takes ownership of
+// `closure`.
+void whisper_params_hook_new_segment(struct whisper_full_params* p, void (*call)(void*, int32_t), void* closure) {
+    params_hooked_t* h = (params_hooked_t*)p;
+    if (h->on_segment_closure) moonbit_decref(h->on_segment_closure);
+    h->on_segment = call;
+    h->on_segment_closure = closure;
+    p->new_segment_callback = hook_new_segment;
+    p->new_segment_callback_user_data = h;
+}
+
+static void hook_progress(struct whisper_context* ctx, struct whisper_state* state, int progress, void* user_data) {
+    params_hooked_t* h = (params_hooked_t*)user_data;
+    moonbit_incref(h->on_progress_closure);
+    h->on_progress(h->on_progress_closure, progress);
+}
+
+// Call `call(closure, percent)` as whisper advances through the audio.
+// Takes ownership of `closure`.
+void whisper_params_hook_progress(struct whisper_full_params* p, void (*call)(void*, int32_t), void* closure) {
+    params_hooked_t* h = (params_hooked_t*)p;
+    if (h->on_progress_closure) moonbit_decref(h->on_progress_closure);
+    h->on_progress = call;
+    h->on_progress_closure = closure;
+    p->progress_callback = hook_progress;
+    p->progress_callback_user_data = h;
+}
+
+static bool hook_should_stop(params_hooked_t* h) {
+    if (__atomic_load_n(&h->stop, __ATOMIC_RELAXED) != HOOK_STOP_NONE) return true;
+    if (h->deadline > 0 && now_ms() >= h->deadline) {
+        int32_t none = HOOK_STOP_NONE;
+        __atomic_compare_exchange_n(&h->stop, &none, HOOK_STOP_DEADLINE, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        return true;
+    }
+    return false;
+}
+
+static bool hook_abort(void* user_data) {
+    return hook_should_stop((params_hooked_t*)user_data);
+}
+
+static bool hook_encoder_begin(struct whisper_context* ctx, struct whisper_state* state, void* user_data) {
+    return !hook_should_stop((params_hooked_t*)user_data);
+}
+
+// Make the run stoppable with whisper_params_hook_cancel and, if
+// `timeout_ms` > 0, stop it on its own that many ms from now. A stopped run
+// keeps the segments of the windows it finished.
+void whisper_params_hook_stop(struct whisper_full_params* p, int32_t timeout_ms) {
+    params_hooked_t* h = (params_hooked_t*)p;
+    h->deadline = timeout_ms > 0 ? now_ms() + (double)timeout_ms : 0;
+    p->abort_callback = hook_abort;
+    p->abort_callback_user_data = h;
+    p->encoder_begin_callback = hook_encoder_begin;
+    p->encoder_begin_callback_user_data = h;
+}
+
+void whisper_params_hook_cancel(struct whisper_full_params* p) {
+    params_hooked_t* h = (params_hooked_t*)p;
+    int32_t none = HOOK_STOP_NONE;
+    __atomic_compare_exchange_n(&h->stop, &none, HOOK_STOP_CANCELLED, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+// HOOK_STOP_* reason the run stopped early, or HOOK_STOP_NONE.
+int32_t whisper_params_hook_stopped(struct whisper_full_params* p) {
+    return __atomic_load_n(&((params_hooked_t*)p)->stop, __ATOMIC_RELAXED);
+}
+
+void whisper_params_unhook(struct whisper_full_params* p) {
+    if (!p) return;
+    params_hooked_t* h = (params_hooked_t*)p;
+    if (h->on_segment_closure) moonbit_decref(h->on_segment_closure);
+    if (h->on_progress_closure) moonbit_decref(h->on_progress_closure);
+    free(h);
+}
+
+// --- WAV loading (PCM / float WAV, RF64 -> mono float32 at 16kHz) ---
+//
+// The file is mmap'd read-only and the RIFF header is parsed in place, so the
+// data chunk is converted straight from the page cache into the final 16kHz
+// float buffer without intermediate int16 / pre-resample copies.
+
+typedef struct {
+    float* data;
+    int count;
+    int origin;  // index of data[0] in the whole file's 16kHz timeline
+} wav_samples_t;
+
+static wav_samples_t* g_last_samples = NULL;
+
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    file_id_t id;
+} mapped_file_t;
+
+// Map a whole file read-only. Returns 0 on success.
+static int map_file(const char* path, mapped_file_t* out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+    posix_madvise(p, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+    out->base = (const uint8_t*)p;
+    out->size = (size_t)st.st_size;
+    out->id = file_id_of(&st);
+    return 0;
+}
+
+static void unmap_file(mapped_file_t* m) {
+    if (m->base) munmap((void*)m->base, m->size);
+    m->base = NULL;
+    m->size = 0;
+}
+
+// --- Load statistics ---
+//
+// Loads go through whisper's own init functions and only the whole call is
+// timed. With the params' `timed` flag, the load instead goes through a
+// whisper_model_loader wrapped to time its read callback, so the load time
+// splits into reading the file (or copying out of the buffer) and
+// everything whisper does in between: parsing, allocating backend buffers
+// and, without no_state, the default state. The statistics land in the
+// cparams_owned_t the context was loaded with. The weight bytes per ggml
+// type are totalled from the file's tensor headers the first time they are
+// asked for, so loads that never look at them don't read the file twice,
+// and only if the path still names the file that was loaded (same device,
+// inode, size and mtime); otherwise they stay empty.
+
+typedef struct {
+    whisper_model_loader inner;
+    load_stats_t* stats;
+} timed_loader_t;
+
+static size_t timed_loader_read(void* ctx, void* output, size_t read_size) {
+    timed_loader_t* t = (timed_loader_t*)ctx;
+    double t0 = now_ms();
+    size_t n = t->inner.read(t->inner.context, output, read_size);
+    t->stats->read_ms += now_ms() - t0;
+    t->stats->read_bytes += (int64_t)n;
+    return n;
+}
+
+static bool timed_loader_eof(void* ctx) {
+    timed_loader_t* t = (timed_loader_t*)ctx;
+    return t->inner.eof(t->inner.context);
+}
+
+static void timed_loader_close(void* ctx) {
+    timed_loader_t* t = (timed_loader_t*)ctx;
+    t->inner.close(t->inner.context);
+}
+
+// Buffered stdio reads, the equivalent of whisper's own ifstream loader.
+// The FILE is closed by the caller.
+static size_t file_loader_read(void* ctx, void* output, size_t read_size) {
+    return fread(output, 1, read_size, (FILE*)ctx);
+}
+
+static bool file_loader_eof(void* ctx) {
+    return feof((FILE*)ctx) != 0;
+}
+
+static void file_loader_close(void* ctx) {
+    (void)ctx;
+}
+
+// Reads out of a caller-owned buffer.
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    size_t pos;
+} buffer_loader_t;
+
+static size_t buffer_loader_read(void* ctx, void* output, size_t read_size) {
+    buffer_loader_t* b = (buffer_loader_t*)ctx;
+    size_t left = b->size - b->pos;
+    if (read_size > left) read_size = left;
+    memcpy(output, b->base + b->pos, read_size);
+    b->pos += read_size;
+    return read_size;
+}
+
+static bool buffer_loader_eof(void* ctx) {
+    buffer_loader_t* b = (buffer_loader_t*)ctx;
+    return b->pos >= b->size;
+}
+
+static void buffer_loader_close(void* ctx) {
+    (void)ctx;
+}
+
+// Walk a ggml whisper model image (magic, 11 int32 hparams, mel filters,
+// vocab, then n_dims / name length / type / ne[] / name / data per tensor)
+// and total the tensor data bytes per ggml type. Returns 0, or -1 (leaving
+// `st` untouched) if the image is not in that format or is truncated.
+static int model_scan_weights(const uint8_t* p, size_t size, load_stats_t* st) {
+    int64_t weight_bytes[GGML_TYPE_COUNT] = {0};
+    int32_t weight_tensors[GGML_TYPE_COUNT] = {0};
+    size_t pos = 0;
+#define SCAN_I32(out)                               \
+    do {                                            \
+        if (size - pos < 4) return -1;              \
+        memcpy(&(out), p + pos, 4);                 \
+        pos += 4;                                   \
+    } while (0)
+#define SCAN_SKIP(n)                                \
+    do {                                            \
+        if ((uint64_t)(n) > size - pos) return -1;  \
+        pos += (size_t)(n);                         \
+    } while (0)
+    uint32_t magic;
+    SCAN_I32(magic);
+    if (magic != 0x67676d6c) return -1;  // "ggml"
+    SCAN_SKIP(11 * 4);
+    int32_t n_mel, n_fft, n_vocab;
+    SCAN_I32(n_mel);
+    SCAN_I32(n_fft);
+    if (n_mel < 0 || n_fft < 0) return -1;
+    SCAN_SKIP((uint64_t)n_mel * (uint64_t)n_fft * 4);
+    SCAN_I32(n_vocab);
+    for (int32_t i = 0; i < n_vocab; i++) {
+        uint32_t len;
+        SCAN_I32(len);
+        SCAN_SKIP(len);
+    }
+    while (pos < size) {
+        int32_t n_dims, name_len, ttype;
+        SCAN_I32(n_dims);
+        SCAN_I32(name_len);
+        SCAN_I32(ttype);
+        if (n_dims < 1 || n_dims > 4 || name_len < 0 || ttype < 0 || ttype >= GGML_TYPE_COUNT) return -1;
+        int64_t n_elements = 1;
+        for (int32_t d = 0; d < n_dims; d++) {
+            int32_t ne;
+            SCAN_I32(ne);
+            if (ne < 0) return -1;
+            n_elements *= ne;
+        }
+        SCAN_SKIP(name_len);
+        int64_t blck = ggml_blck_size((enum ggml_type)ttype);
+        if (blck <= 0) return -1;
+        uint64_t n_bytes = (uint64_t)n_elements * ggml_type_size((enum ggml_type)ttype) / (uint64_t)blck;
+        SCAN_SKIP(n_bytes);
+        weight_bytes[ttype] += (int64_t)n_bytes;
+        weight_tensors[ttype]++;
+    }
+#undef SCAN_I32
+#undef SCAN_SKIP
+    memcpy(st->weight_bytes, weight_bytes, sizeof(weight_bytes));
+    memcpy(st->weight_tensors, weight_tensors, sizeof(weight_tensors));
+    return 0;
+}
+
+// Through `inner`, timed when the params ask for it.
+static struct whisper_context* ctx_load_loader(whisper_model_loader inner, struct whisper_context_params* cparams, int no_state) {
+    cparams_owned_t* o = (cparams_owned_t*)cparams;
+    timed_loader_t t = {inner, &o->stats};
+    whisper_model_loader timed = {&t, timed_loader_read, timed_loader_eof, timed_loader_close};
+    whisper_model_loader* loader = o->timed ? &timed : &inner;
+    return no_state ? whisper_init_with_params_no_state(loader, *cparams)
+                    : whisper_init_with_params(loader, *cparams);
+}
+
+static void load_stats_reset(cparams_owned_t* o) {
+    memset(&o->stats, 0, sizeof(o->stats));
+    free(o->model_path);
+    o->model_path = NULL;
+}
+
+// `cparams` must come from whisper_cparams_create (or be a registry entry's).
+static struct whisper_context* ctx_load_file(const char* path, struct whisper_context_params* cparams, int no_state) {
+    cparams_owned_t* o = (cparams_owned_t*)cparams;
+    load_stats_reset(o);
+    struct stat before, after;
+    const int have_id = stat(path, &before) == 0;
+    struct whisper_context* ctx = NULL;
+    double t0 = now_ms();
+    if (o->timed) {
+        FILE* f = fopen(path, "rb");
+        if (!f) return NULL;
+        whisper_model_loader inner = {f, file_loader_read, file_loader_eof, file_loader_close};
+        ctx = ctx_load_loader(inner, cparams, no_state);
+        fclose(f);
+    } else {
+        ctx = no_state ? whisper_init_from_file_with_params_no_state(path, *cparams)
+                       : whisper_init_from_file_with_params(path, *cparams);
+    }
+    o->stats.load_ms = now_ms() - t0;
+    o->stats.timed = o->timed;
+    // The weight scan reads the path again later; remember which file it
+    // named, unless it was replaced mid-load and either could have been read.
+    if (ctx && have_id && stat(path, &after) == 0) {
+        file_id_t id = file_id_of(&before);
+        file_id_t now = file_id_of(&after);
+        if (file_id_equal(&id, &now)) {
+            o->model_path = strdup(path);
+            o->model_id = id;
+        }
+    }
+    return ctx;
+}
+
+struct whisper_context* whisper_ctx_init_with_cparams(moonbit_bytes_t model_path, struct whisper_context_params* cparams, int32_t no_state) {
+    if (!cparams) return NULL;
+    char* path = bytes_to_cstring(model_path);
+    struct whisper_context* ctx = ctx_load_file(path, cparams, no_state);
+    free(path);
+    return ctx;
+}
+
+// Load from a model image in memory (a borrowed MoonBit Bytes). whisper reads
+// the tensors straight out of it; the buffer only needs to live for the call.
+// It is gone by the time the weights could be asked for, so a timed load
+// totals them right away and an untimed one leaves them empty.
+struct whisper_context* whisper_ctx_init_from_buffer(moonbit_bytes_t data, struct whisper_context_params* cparams, int32_t no_state) {
+    if (!data || !cparams) return NULL;
+    size_t size = (size_t)Moonbit_array_length(data);
+    if (size == 0) return NULL;
+    cparams_owned_t* o = (cparams_owned_t*)cparams;
+    load_stats_reset(o);
+    struct whisper_context* ctx = NULL;
+    double t0 = now_ms();
+    if (o->timed) {
+        buffer_loader_t b = {(const uint8_t*)data, size, 0};
+        whisper_model_loader inner = {&b, buffer_loader_read, buffer_loader_eof, buffer_loader_close};
+        ctx = ctx_load_loader(inner, cparams, no_state);
+        if (ctx) model_scan_weights(b.base, b.size, &o->stats);
+    } else {
+        ctx = no_state ? whisper_init_from_buffer_with_params_no_state(data, size, *cparams)
+                       : whisper_init_from_buffer_with_params(data, size, *cparams);
+    }
+    o->stats.load_ms = now_ms() - t0;
+    o->stats.timed = o->timed;
+    o->stats.scanned = 1;
+    return ctx;
+}
+
+// Registry entries' params are shared by every holder of the model, so the
+// first look at the weights is serialized.
+static pthread_mutex_t g_scan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const load_stats_t* load_stats_weights(struct whisper_context_params* p) {
+    cparams_owned_t* o = (cparams_owned_t*)p;
+    pthread_mutex_lock(&g_scan_lock);
+    if (!o->stats.scanned && o->model_path) {
+        mapped_file_t map = {0};
+        if (map_file(o->model_path, &map) == 0) {
+            // a file replaced since the load says nothing about this model
+            if (file_id_equal(&map.id, &o->model_id)) model_scan_weights(map.base, map.size, &o->stats);
+            unmap_file(&map);
+        }
+    }
+    o->stats.scanned = 1;
+    pthread_mutex_unlock(&g_scan_lock);
+    return &o->stats;
+}
+
+double whisper_cparams_load_ms(struct whisper_context_params* p) {
+    return ((cparams_owned_t*)p)->stats.load_ms;
+}
+
+// -1 unless the load was timed.
+double whisper_cparams_read_ms(struct whisper_context_params* p) {
+    const load_stats_t* st = &((cparams_owned_t*)p)->stats;
+    return st->timed ? st->read_ms : -1.0;
+}
+
+int64_t whisper_cparams_read_bytes(struct whisper_context_params* p) {
+    const load_stats_t* st = &((cparams_owned_t*)p)->stats;
+    return st->timed ? st->read_bytes : -1;
+}
+
+int64_t whisper_cparams_weight_bytes(struct whisper_context_params* p, int32_t type) {
+    if (type < 0 || type >= GGML_TYPE_COUNT) return 0;
+    return load_stats_weights(p)->weight_bytes[type];
+}
+
+int32_t whisper_cparams_weight_tensors(struct whisper_context_params* p, int32_t type) {
+    if (type < 0 || type >= GGML_TYPE_COUNT) return 0;
+    return load_stats_weights(p)->weight_tensors[type];
+}
+
+int32_t whisper_ggml_type_count(void) {
+    return GGML_TYPE_COUNT;
+}
+
+moonbit_bytes_t whisper_ggml_type_name(int32_t type) {
+    if (type < 0 || type >= GGML_TYPE_COUNT) return cstring_to_bytes(NULL);
+    return cstring_to_bytes(ggml_type_name((enum ggml_type)type));
+}
+
+// --- Shared model registry ---
+//
+// Process-wide table of stateless contexts keyed by the model file's identity
+// (canonical path, device, inode, size, mtime) and the context params, so
+// components that load the same model with the same options share one copy
+// of the weights. Whether the load is timed is not part of the key: the
+// same weights result either way, so the first acquire's setting wins.
+// Each acquire / retain takes a reference and each release drops one; the
+// context is freed with the last. A model is loaded outside the registry
+// lock behind a placeholder entry: concurrent acquires of the same key wait
+// for that load instead of starting another, and acquires of other models
+// are never held up by it.
+
+typedef struct model_entry {
+    struct model_entry* next;
+    char* path;  // realpath
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+    cparams_owned_t cparams;  // own copy; whisper keeps pointing at its heads
+    struct whisper_context* ctx;  // NULL while loading
+    int loading;
+    int refs;
+} model_entry_t;
+
+static model_entry_t* g_models = NULL;
+static pthread_mutex_t g_models_lock = PTHREAD_MUTEX_INITIALIZER;
+// signalled whenever a load finishes
+static pthread_cond_t g_models_loaded = PTHREAD_COND_INITIALIZER;
+
+static int cparams_equal(const struct whisper_context_params* a, const struct whisper_context_params* b) {
+    if (a->use_gpu != b->use_gpu || a->flash_attn != b->flash_attn || a->gpu_device != b->gpu_device ||
+        a->dtw_token_timestamps != b->dtw_token_timestamps || a->dtw_aheads_preset != b->dtw_aheads_preset ||
+        a->dtw_n_top != b->dtw_n_top || a->dtw_mem_size != b->dtw_mem_size ||
+        a->dtw_aheads.n_heads != b->dtw_aheads.n_heads) {
+        return 0;
+    }
+    for (size_t i = 0; i < a->dtw_aheads.n_heads; i++) {
+        if (a->dtw_aheads.heads[i].n_text_layer != b->dtw_aheads.heads[i].n_text_layer ||
+            a->dtw_aheads.heads[i].n_head != b->dtw_aheads.heads[i].n_head) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void model_entry_free(model_entry_t* e) {
+    if (e->ctx) whisper_free(e->ctx);
+    free(e->cparams.heads);
+    free(e->cparams.model_path);
+    free(e->path);
+    free(e);
+}
+
+// Call with g_models_lock held.
+static void model_entry_unlink(model_entry_t* e) {
+    for (model_entry_t** link = &g_models; *link; link = &(*link)->next) {
+        if (*link == e) {
+            *link = e->next;
+            return;
+        }
+    }
+}
+
+// Returns a stateless context for the model at `model_path` loaded with
+// `cparams`, loading it on first use. NULL if the file cannot be loaded.
+struct whisper_context* whisper_registry_acquire(moonbit_bytes_t model_path, struct whisper_context_params* cparams) {
+    if (!cparams) return NULL;
+    char* path = bytes_to_cstring(model_path);
+    char* real = realpath(path, NULL);
+    free(path);
+    struct stat st;
+    if (!real || stat(real, &st) != 0) {
+        free(real);
+        return NULL;
+    }
+    int64_t mtime_ns = stat_mtime_ns(&st);
+    struct whisper_context* ctx = NULL;
+    model_entry_t* dead = NULL;
+    pthread_mutex_lock(&g_models_lock);
+    model_entry_t* e = g_models;
+    while (e && !(e->dev == st.st_dev && e->ino == st.st_ino && e->size == st.st_size && e->mtime_ns == mtime_ns &&
+                  strcmp(e->path, real) == 0 && cparams_equal(&e->cparams.params, cparams))) {
+        e = e->next;
+    }
+    if (e) {
+        // the reference also keeps the entry alive if its load fails
+        e->refs++;
+        while (e->loading) pthread_cond_wait(&g_models_loaded, &g_models_lock);
+        ctx = e->ctx;
+        if (!ctx && --e->refs == 0) dead = e;
+        pthread_mutex_unlock(&g_models_lock);
+        if (dead) model_entry_free(dead);
+        free(real);
+        return ctx;
+    }
+
+    e = (model_entry_t*)calloc(1, sizeof(model_entry_t));
+    size_t n_heads = cparams->dtw_aheads.n_heads;
+    if (e) {
+        e->cparams.params = *cparams;
+        e->cparams.timed = ((const cparams_owned_t*)cparams)->timed;
+        if (n_heads > 0) {
+            e->cparams.heads = (whisper_ahead*)malloc(n_heads * sizeof(whisper_ahead));
+            if (e->cparams.heads) {
+                memcpy(e->cparams.heads, cparams->dtw_aheads.heads, n_heads * sizeof(whisper_ahead));
+            }
+            e->cparams.params.dtw_aheads.heads = e->cparams.heads;
+        }
+    }
+    if (!e || (n_heads > 0 && !e->cparams.heads)) {
+        pthread_mutex_unlock(&g_models_lock);
+        if (e) model_entry_free(e);
+        free(real);
+        return NULL;
+    }
+    e->path = real;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->size = st.st_size;
+    e->mtime_ns = mtime_ns;
+    e->loading = 1;
+    e->refs = 1;
+    e->next = g_models;
+    g_models = e;
+    pthread_mutex_unlock(&g_models_lock);
+
+    // the key fields are not written again, so the load can read them unlocked
+    ctx = ctx_load_file(e->path, &e->cparams.params, 1);
+
+    pthread_mutex_lock(&g_models_lock);
+    e->ctx = ctx;
+    e->loading = 0;
+    if (!ctx) {
+        // later acquires try again; waiters drop their references
+        model_entry_unlink(e);
+        if (--e->refs == 0) dead = e;
+    }
+    pthread_cond_broadcast(&g_models_loaded);
+    pthread_mutex_unlock(&g_models_lock);
+    if (dead) model_entry_free(dead);
+    return ctx;
+}
+
+// Take another reference on a registry context. Returns the new count, or
+// -1 if `ctx` is not in the registry.
+int32_t whisper_registry_retain(struct whisper_context* ctx) {
+    int32_t refs = -1;
+    if (!ctx) return -1;
+    pthread_mutex_lock(&g_models_lock);
+    for (model_entry_t* e = g_models; e; e = e->next) {
+        if (e->ctx == ctx) {
+            refs = ++e->refs;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_models_lock);
+    return refs;
+}
+
+// Drop a reference; the context is freed when none are left. Returns the
+// remaining count, or -1 if `ctx` is not in the registry.
+int32_t whisper_registry_release(struct whisper_context* ctx) {
+    int32_t refs = -1;
+    if (!ctx) return -1;
+    model_entry_t* dead = NULL;
+    pthread_mutex_lock(&g_models_lock);
+    for (model_entry_t** link = &g_models; *link; link = &(*link)->next) {
+        model_entry_t* e = *link;
+        if (e->ctx == ctx) {
+            refs = --e->refs;
+            if (refs == 0) {
+                *link = e->next;
+                dead = e;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_models_lock);
+    if (dead) model_entry_free(dead);
+    return refs;
+}
+
+// References held on a registry context (0 if it is not registered).
+int32_t whisper_registry_refs(struct whisper_context* ctx) {
+    int32_t refs = 0;
+    if (!ctx) return 0;
+    pthread_mutex_lock(&g_models_lock);
+    for (model_entry_t* e = g_models; e; e = e->next) {
+        if (e->ctx == ctx) {
+            refs = e->refs;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_models_lock);
+    return refs;
+}
+
+// The params a registry context was loaded with, which hold its load
+// statistics. Valid while a reference is held; NULL if `ctx` is not
+// registered.
+struct whisper_context_params* whisper_registry_cparams(struct whisper_context* ctx) {
+    struct whisper_context_params* p = NULL;
+    if (!ctx) return NULL;
+    pthread_mutex_lock(&g_models_lock);
+    for (model_entry_t* e = g_models; e; e = e->next) {
+        if (e->ctx == ctx) {
+            p = &e->cparams.params;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_models_lock);
+    return p;
+}
+
+// Number of distinct models currently loaded through the registry.
+int32_t whisper_registry_size(void) {
+    int32_t n = 0;
+    pthread_mutex_lock(&g_models_lock);
+    for (model_entry_t* e = g_models; e; e = e->next) n += e->ctx != NULL;
+    pthread_mutex_unlock(&g_models_lock);
+    return n;
+}
+
+static inline uint16_t rd_u16(const uint8_t* p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return v;
+}
+
+static inline uint32_t rd_u32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline int16_t rd_i16(const uint8_t* p) {
+    int16_t v;
+    memcpy(&v, p, 2);
+    return v;
+}
+
+static inline int32_t rd_i32(const uint8_t* p) {
+    int32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t rd_u64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline float rd_f32(const uint8_t* p) {
+    float v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Sign-extend a little-endian 24-bit sample.
+static inline int32_t rd_s24(const uint8_t* p) {
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+}
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+// Sample layout of the data chunk, by container size
+enum {
+    SAMPLE_UNSUPPORTED = 0,
+    SAMPLE_U8,
+    SAMPLE_S16,
+    SAMPLE_S24,
+    SAMPLE_S32,
+    SAMPLE_F32,
+};
+
+typedef struct flac_stream flac_stream_t;
+
+// Parsed view of a RIFF/WAVE buffer. `data` points into the source buffer.
+typedef struct {
+    int audio_format;
+    int num_channels;
+    int sample_rate;
+    int bits_per_sample;
+    int sample_format;
+    size_t frame_bytes;
+    const uint8_t* data;
+    size_t data_size;
+    // FLAC: data is NULL and the frames are decoded on demand into the
+    // interleaved float32 format described above
+    const flac_stream_t* flac;
+} wav_info_t;
+
+// Fill the format fields of `info` from a "fmt " chunk body.
+static int wav_parse_fmt(const uint8_t* body, size_t len, wav_info_t* info) {
+    if (len < 16) return -1;
+    info->audio_format = rd_u16(body);
+    info->num_channels = rd_u16(body + 2);
+    info->sample_rate = (int)rd_u32(body + 4);
+    // skip byte_rate(4)
+    int block_align = rd_u16(body + 12);
+    info->bits_per_sample = rd_u16(body + 14);
+    if (info->num_channels < 1) return -1;
+
+    int format = info->audio_format;
+    if (format == WAVE_FORMAT_EXTENSIBLE) {
+        // cbSize(2) valid_bits(2) channel_mask(4), then the SubFormat GUID
+        // whose first two bytes are the plain format code
+        if (len < 40) return -1;
+        format = rd_u16(body + 24);
+    }
+    // Samples narrower than their container (e.g. 24 in 32) are
+    // left-justified, so decoding by container size is exact.
+    int container = (info->bits_per_sample + 7) / 8;
+    if (block_align / info->num_channels > container) {
+        container = block_align / info->num_channels;
+    }
+    info->frame_bytes = (size_t)container * info->num_channels;
+    info->sample_format = SAMPLE_UNSUPPORTED;
+    if (format == WAVE_FORMAT_PCM) {
+        switch (container) {
+            case 1: info->sample_format = SAMPLE_U8; break;
+            case 2: info->sample_format = SAMPLE_S16; break;
+            case 3: info->sample_format = SAMPLE_S24; break;
+            case 4: info->sample_format = SAMPLE_S32; break;
+        }
+    } else if (format == WAVE_FORMAT_IEEE_FLOAT && container == 4) {
+        info->sample_format = SAMPLE_F32;
+    }
+    return 0;
+}
+
+// RF64 / BW64 replace 32-bit sizes with 0xFFFFFFFF and carry the real data
+// size in a leading "ds64" chunk: riff_size(8) data_size(8) sample_count(8).
+static int wav_is_rf64(const uint8_t* hdr) {
+    return memcmp(hdr, "RF64", 4) == 0 || memcmp(hdr, "BW64", 4) == 0;
+}
+
+// Walk the RIFF chunks of an in-memory WAV image. Returns 0 on success.
+static int wav_parse(const uint8_t* buf, size_t size, wav_info_t* info) {
+    memset(info, 0, sizeof(*info));
+    if (size < 12 || (memcmp(buf, "RIFF", 4) != 0 && !wav_is_rf64(buf)) || memcmp(buf + 8, "WAVE", 4) != 0) {
+        return -1;
+    }
+    const int rf64 = wav_is_rf64(buf);
+    uint64_t ds64_data_size = 0;
+    int have_fmt = 0;
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        const uint8_t* chunk = buf + pos;
+        size_t chunk_size = rd_u32(chunk + 4);
+        size_t avail = size - pos - 8;
+        if (memcmp(chunk, "ds64", 4) == 0) {
+            if (chunk_size < 24 || chunk_size > avail) return -1;
+            ds64_data_size = rd_u64(chunk + 16);
+        } else if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (chunk_size > avail || wav_parse_fmt(chunk + 8, chunk_size, info) != 0) return -1;
+            have_fmt = 1;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_fmt) return -1;
+            if (rf64 && chunk_size == 0xFFFFFFFFu) chunk_size = (size_t)ds64_data_size;
+            // Writers that stream to disk may leave the size unpatched
+            if (chunk_size > avail) chunk_size = avail;
+            info->data = chunk + 8;
+            info->data_size = chunk_size;
+            return 0;
+        }
+        // Chunks are word-aligned
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    return -1;
+}
+
+// --- FLAC decoding ---
+//
+// Dependency-free decoder for native FLAC streams (no Ogg). Nothing is
+// decoded up front: a window is located by bisecting on the sample numbers
+// in frame headers, the frames under it are indexed by a sequential scan
+// (sync code, header CRC-8 and whole-frame CRC-16 must agree), and they are
+// decoded in parallel one frame at a time into the same mono conversion and
+// resampling path as WAV data. Streams deeper than 24 bits are rejected.
+
+#define FLAC_MAX_CHANNELS 8
+#define FLAC_MAX_LPC_ORDER 32
+// Frames per thread below which a single thread is used
+#define FLAC_MIN_FRAMES_PER_THREAD 64
+#define FLAC_MAX_THREADS 8
+// Byte span below which flac_seek stops bisecting and walks frames
+#define FLAC_SEEK_SPAN (64 * 1024)
+
+static uint8_t g_crc8_table[256];
+static uint16_t g_crc16_table[256];
+static pthread_once_t g_flac_crc_once = PTHREAD_ONCE_INIT;
+
+static void flac_crc_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t c8 = (uint8_t)i;
+        uint16_t c16 = (uint16_t)(i << 8);
+        for (int b = 0; b < 8; b++) {
+            c8 = (uint8_t)(c8 & 0x80 ? (c8 << 1) ^ 0x07 : c8 << 1);
+            c16 = (uint16_t)(c16 & 0x8000 ? (c16 << 1) ^ 0x8005 : c16 << 1);
+        }
+        g_crc8_table[i] = c8;
+        g_crc16_table[i] = c16;
+    }
+}
+
+typedef struct {
+    int sample_rate;
+    int channels;
+    int bps;
+    int max_block;
+} flac_streaminfo_t;
+
+typedef struct {
+    int block_size;
+    int sample_rate;  // 0: from STREAMINFO
+    int ch_assign;
+    int bps;          // 0: from STREAMINFO
+    size_t header_len;
+    int64_t first_sample;  // as coded in the header
+} flac_frame_header_t;
+
+typedef struct {
+    size_t offset;
+    size_t size;
+    int64_t first_sample;
+    int block_size;
+} flac_frame_ref_t;
+
+// A FLAC image opened for decoding on demand.
+struct flac_stream {
+    const uint8_t* buf;
+    size_t size;
+    flac_streaminfo_t si;
+    size_t first_frame;   // offset of the first frame
+    int64_t sample_base;  // sample number coded in its header
+    int64_t total;        // samples per channel
+};
+
+// Big-endian bit reader over one frame. Reads past the end return zeros
+// and set `err`.
+typedef struct {
+    const uint8_t* buf;
+    size_t size;
+    size_t bitpos;
+    int err;
+} flac_bits_t;
+
+static inline uint64_t flac_peek64(const flac_bits_t* br) {
+    size_t byte = br->bitpos >> 3;
+    uint64_t v = 0;
+    if (byte + 8 <= br->size) {
+        memcpy(&v, br->buf + byte, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+    } else {
+        for (int i = 0; i < 8; i++) v = (v << 8) | (byte + i < br->size ? br->buf[byte + i] : 0);
+    }
+    return v << (br->bitpos & 7);
+}
+
+// n <= 32
+static inline uint32_t flac_bits(flac_bits_t* br, int n) {
+    if (n == 0) return 0;
+    uint32_t v = (uint32_t)(flac_peek64(br) >> (64 - n));
+    br->bitpos += (size_t)n;
+    if (br->bitpos > br->size * 8) br->err = 1;
+    return v;
+}
+
+static inline int32_t flac_sbits(flac_bits_t* br, int n) {
+    if (n == 0) return 0;
+    uint32_t v = flac_bits(br, n);
+    return n == 32 ? (int32_t)v : (int32_t)(v << (32 - n)) >> (32 - n);
+}
+
+// Number of 0 bits before the next 1 bit, which is consumed.
+static inline uint32_t flac_unary(flac_bits_t* br) {
+    uint32_t zeros = 0;
+    while (1) {
+        uint64_t v = flac_peek64(br);
+        // only 57 bits of the peek are guaranteed fresh
+        v &= ~(uint64_t)0x7F;
+        if (v != 0) {
+            int lz = __builtin_clzll(v);
+            br->bitpos += (size_t)lz + 1;
+            zeros += (uint32_t)lz;
+            break;
+        }
+        br->bitpos += 57;
+        zeros += 57;
+        if (br->bitpos > br->size * 8) {
+            br->err = 1;
+            return 0;
+        }
+    }
+    if (br->bitpos > br->size * 8) br->err = 1;
+    return zeros;
+}
+
+static int flac_is_sync(const uint8_t* p) {
+    return p[0] == 0xFF && (p[1] & 0xFE) == 0xF8;
+}
+
+// Parse and CRC-check the frame header at p. Returns 0 on success.
+static int flac_parse_frame_header(const uint8_t* p, size_t avail, const flac_streaminfo_t* si, flac_frame_header_t* h) {
+    if (avail < 6 || !flac_is_sync(p)) return -1;
+    int bs_code = p[2] >> 4, sr_code = p[2] & 0x0F;
+    int ch_assign = p[3] >> 4, ss_code = (p[3] >> 1) & 7;
+    if ((p[3] & 1) || bs_code == 0 || sr_code == 15 || ch_assign > 10 || ss_code == 3 || ss_code == 7) return -1;
+    size_t pos = 4;
+    // UTF-8 style coded frame / sample number
+    int extra = 0;
+    uint8_t first = p[pos++];
+    if (first & 0x80) {
+        while (extra < 7 && (first & (0x40 >> extra))) extra++;
+        if (extra == 0 || extra > 6) return -1;
+    }
+    if (pos + (size_t)extra > avail) return -1;
+    uint64_t number = first & (0x7F >> extra);
+    for (int i = 0; i < extra; i++) {
+        if ((p[pos] & 0xC0) != 0x80) return -1;
+        number = (number << 6) | (p[pos++] & 0x3F);
+    }
+    int block_size;
+    if (bs_code == 1) {
+        block_size = 192;
+    } else if (bs_code <= 5) {
+        block_size = 576 << (bs_code - 2);
+    } else if (bs_code == 6) {
+        if (pos + 1 > avail) return -1;
+        block_size = p[pos] + 1;
+        pos += 1;
+    } else if (bs_code == 7) {
+        if (pos + 2 > avail) return -1;
+        block_size = ((p[pos] << 8) | p[pos + 1]) + 1;
+        pos += 2;
+    } else {
+        block_size = 256 << (bs_code - 8);
+    }
+    static const int sr_table[12] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+    int sample_rate;
+    if (sr_code < 12) {
+        sample_rate = sr_table[sr_code];
+    } else {
+        size_t n = sr_code == 12 ? 1 : 2;
+        if (pos + n > avail) return -1;
+        int v = n == 1 ? p[pos] : (p[pos] << 8) | p[pos + 1];
+        sample_rate = sr_code == 12 ? v * 1000 : sr_code == 13 ? v : v * 10;
+        pos += n;
+    }
+    if (pos + 1 > avail) return -1;
+    pthread_once(&g_flac_crc_once, flac_crc_init);
+    uint8_t crc = 0;
+    for (size_t i = 0; i < pos; i++) crc = g_crc8_table[crc ^ p[i]];
+    if (crc != p[pos]) return -1;
+    static const int ss_table[8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+    h->block_size = block_size;
+    h->sample_rate = sample_rate;
+    h->ch_assign = ch_assign;
+    h->bps = ss_table[ss_code];
+    h->header_len = pos + 1;
+    // variable-blocksize streams code the sample number, fixed ones the
+    // frame number
+    h->first_sample = (int64_t)(p[1] & 1 ? number : number * (uint64_t)si->max_block);
+    int channels = ch_assign < 8 ? ch_assign + 1 : 2;
+    if (channels != si->channels) return -1;
+    if (h->bps != 0 && h->bps != si->bps) return -1;
+    if (block_size > si->max_block && si->max_block > 0) return -1;
+    return 0;
+}
+
+// Residual of one subframe into out[order, block_size).
+static int flac_residual(flac_bits_t* br, int block_size, int order, int32_t* out) {
+    int method = (int)flac_bits(br, 2);
+    if (method > 1) return -1;
+    const int param_bits = method == 0 ? 4 : 5;
+    const uint32_t escape = method == 0 ? 15 : 31;
+    int part_order = (int)flac_bits(br, 4);
+    int n_parts = 1 << part_order;
+    if ((block_size >> part_order) < order || (block_size & (n_parts - 1)) != 0) return -1;
+    int i = order;
+    for (int part = 0; part < n_parts; part++) {
+        int n = (block_size >> part_order) - (part == 0 ? order : 0);
+        uint32_t k = flac_bits(br, param_bits);
+        if (k == escape) {
+            int nbits = (int)flac_bits(br, 5);
+            for (int j = 0; j < n; j++) out[i++] = flac_sbits(br, nbits);
+        } else {
+            for (int j = 0; j < n; j++) {
+                uint32_t q = flac_unary(br);
+                uint32_t v = (q << k) | flac_bits(br, (int)k);
+                out[i++] = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+            }
+        }
+        if (br->err) return -1;
+    }
+    return 0;
+}
+
+static int flac_subframe(flac_bits_t* br, int block_size, int bps, int32_t* out) {
+    if (flac_bits(br, 1) != 0) return -1;
+    int type = (int)flac_bits(br, 6);
+    int wasted = 0;
+    if (flac_bits(br, 1)) wasted = (int)flac_unary(br) + 1;
+    bps -= wasted;
+    if (bps < 1 || bps > 32) return -1;
+
+    if (type == 0) {
+        int32_t v = flac_sbits(br, bps);
+        for (int i = 0; i < block_size; i++) out[i] = v;
+    } else if (type == 1) {
+        for (int i = 0; i < block_size; i++) out[i] = flac_sbits(br, bps);
+    } else if (type >= 8 && type <= 12) {
+        int order = type - 8;
+        if (order > block_size) return -1;
+        for (int i = 0; i < order; i++) out[i] = flac_sbits(br, bps);
+        if (flac_residual(br, block_size, order, out) != 0) return -1;
+        // 64-bit sums: corrupt residuals must not overflow
+        switch (order) {
+            case 1:
+                for (int i = 1; i < block_size; i++) out[i] = (int32_t)((int64_t)out[i] + out[i - 1]);
+                break;
+            case 2:
+                for (int i = 2; i < block_size; i++)
+                    out[i] = (int32_t)((int64_t)out[i] + 2 * (int64_t)out[i - 1] - out[i - 2]);
+                break;
+            case 3:
+                for (int i = 3; i < block_size; i++)
+                    out[i] = (int32_t)((int64_t)out[i] + 3 * ((int64_t)out[i - 1] - out[i - 2]) + out[i - 3]);
+                break;
+            case 4:
+                for (int i = 4; i < block_size; i++)
+                    out[i] = (int32_t)((int64_t)out[i] + 4 * ((int64_t)out[i - 1] + out[i - 3]) -
+                                       6 * (int64_t)out[i - 2] - out[i - 4]);
+                break;
+        }
+    } else if (type >= 32) {
+        int order = (type & 31) + 1;
+        if (order > block_size) return -1;
+        for (int i = 0; i < order; i++) out[i] = flac_sbits(br, bps);
+        int precision = (int)flac_bits(br, 4) + 1;
+        if (precision == 16) return -1;
+        int shift = flac_sbits(br, 5);
+        if (shift < 0) return -1;
+        int32_t coefs[FLAC_MAX_LPC_ORDER];
+        for (int j = 0; j < order; j++) coefs[j] = flac_sbits(br, precision);
+        if (flac_residual(br, block_size, order, out) != 0) return -1;
+        for (int i = order; i < block_size; i++) {
+            int64_t sum = 0;
+            for (int j = 0; j < order; j++) sum += (int64_t)coefs[j] * out[i - 1 - j];
+            out[i] = (int32_t)(out[i] + (sum >> shift));
+        }
+    } else {
+        return -1;
+    }
+    if (br->err) return -1;
+    if (wasted) {
+        for (int i = 0; i < block_size; i++) out[i] = (int32_t)((uint32_t)out[i] << wasted);
+    }
+    return 0;
+}
+
+// Decode one frame into dst (block_size interleaved float frames).
+// scratch holds channels * max_block ints.
+static int flac_decode_frame(const uint8_t* p, size_t size, const flac_streaminfo_t* si, int32_t* scratch, float* dst) {
+    flac_frame_header_t h;
+    if (flac_parse_frame_header(p, size, si, &h) != 0) return -1;
+    const int ch = si->channels;
+    const int bps = si->bps;
+    const int n = h.block_size;
+    flac_bits_t br = { p, size, h.header_len * 8, 0 };
+    int32_t* chan[FLAC_MAX_CHANNELS];
+    for (int c = 0; c < FLAC_MAX_CHANNELS; c++) chan[c] = scratch + (size_t)(c < ch ? c : 0) * si->max_block;
+    for (int c = 0; c < ch; c++) {
+        // the side channel carries one extra bit
+        int side = (h.ch_assign == 8 && c == 1) || (h.ch_assign == 9 && c == 0) || (h.ch_assign == 10 && c == 1);
+        if (flac_subframe(&br, n, bps + side, chan[c]) != 0) return -1;
+    }
+    int32_t* a = chan[0];
+    int32_t* b = ch > 1 ? chan[1] : chan[0];
+    if (h.ch_assign == 8) {
+        for (int i = 0; i < n; i++) b[i] = (int32_t)((int64_t)a[i] - b[i]);
+    } else if (h.ch_assign == 9) {
+        for (int i = 0; i < n; i++) a[i] = (int32_t)((int64_t)a[i] + b[i]);
+    } else if (h.ch_assign == 10) {
+        for (int i = 0; i < n; i++) {
+            int64_t mid = ((int64_t)a[i] * 2) | (b[i] & 1);
+            int64_t side = b[i];
+            a[i] = (int32_t)((mid + side) >> 1);
+            b[i] = (int32_t)((mid - side) >> 1);
+        }
+    }
+    const float scale = 1.0f / (float)(1u << (bps - 1));
+    for (int c = 0; c < ch; c++) {
+        for (int i = 0; i < n; i++) dst[(size_t)i * ch + c] = (float)chan[c][i] * scale;
+    }
+    return 0;
+}
+
+// Metadata blocks up to the first frame. Returns the frame offset or 0.
+static size_t flac_parse_metadata(const uint8_t* buf, size_t size, flac_streaminfo_t* si) {
+    size_t pos = 0;
+    // skip an ID3v2 tag some taggers prepend
+    if (size >= 10 && memcmp(buf, "ID3", 3) == 0) {
+        pos = 10 + (((size_t)(buf[6] & 0x7F) << 21) | ((size_t)(buf[7] & 0x7F) << 14) |
+                    ((size_t)(buf[8] & 0x7F) << 7) | (buf[9] & 0x7F));
+    }
+    if (pos + 4 > size || memcmp(buf + pos, "fLaC", 4) != 0) return 0;
+    pos += 4;
+    int have_streaminfo = 0;
+    int last = 0;
+    while (!last) {
+        if (pos + 4 > size) return 0;
+        last = buf[pos] >> 7;
+        int type = buf[pos] & 0x7F;
+        size_t len = ((size_t)buf[pos + 1] << 16) | ((size_t)buf[pos + 2] << 8) | buf[pos + 3];
+        pos += 4;
+        if (len > size - pos) return 0;
+        if (type == 0) {
+            if (len < 34) return 0;
+            const uint8_t* b = buf + pos;
+            si->max_block = (b[2] << 8) | b[3];
+            si->sample_rate = (b[10] << 12) | (b[11] << 4) | (b[12] >> 4);
+            si->channels = ((b[12] >> 1) & 7) + 1;
+            si->bps = (((b[12] & 1) << 4) | (b[13] >> 4)) + 1;
+            have_streaminfo = 1;
+        }
+        pos += len;
+    }
+    if (!have_streaminfo || si->sample_rate <= 0 || si->bps < 4 || si->bps > 24 || si->max_block < 16) return 0;
+    return pos;
+}
+
+// End of the frame at pos: where the next valid header starts and the
+// CRC-16 over the frame (including its stored CRC) is zero, else `size`.
+static size_t flac_frame_end(const uint8_t* buf, size_t size, size_t pos, const flac_streaminfo_t* si, size_t header_len) {
+    pthread_once(&g_flac_crc_once, flac_crc_init);
+    uint16_t crc = 0;
+    for (size_t q = pos; q < size; q++) {
+        if (q > pos + header_len && crc == 0 && q + 1 < size && flac_is_sync(buf + q)) {
+            flac_frame_header_t next;
+            if (flac_parse_frame_header(buf + q, size - q, si, &next) == 0) return q;
+        }
+        crc = (uint16_t)((crc << 8) ^ g_crc16_table[(crc >> 8) ^ buf[q]]);
+    }
+    return size;
+}
+
+// Frames from the one at pos (whose first sample is `sample`) up to the
+// first that starts at or after `until`.
+static flac_frame_ref_t* flac_scan_frames(const flac_stream_t* fs, size_t pos, int64_t sample, int64_t until, int* n_out) {
+    int cap = 64, n = 0;
+    flac_frame_ref_t* frames = (flac_frame_ref_t*)malloc((size_t)cap * sizeof(flac_frame_ref_t));
+    if (!frames) return NULL;
+    flac_frame_header_t h;
+    while (sample < until && pos < fs->size &&
+           flac_parse_frame_header(fs->buf + pos, fs->size - pos, &fs->si, &h) == 0) {
+        size_t end = flac_frame_end(fs->buf, fs->size, pos, &fs->si, h.header_len);
+        if (n == cap) {
+            cap *= 2;
+            flac_frame_ref_t* grown = (flac_frame_ref_t*)realloc(frames, (size_t)cap * sizeof(flac_frame_ref_t));
+            if (!grown) {
+                free(frames);
+                return NULL;
+            }
+            frames = grown;
+        }
+        frames[n++] = (flac_frame_ref_t){ pos, end - pos, sample, h.block_size };
+        sample += h.block_size;
+        pos = end;
+    }
+    *n_out = n;
+    return frames;
+}
+
+// Start (*pos, *sample) of a frame at or shortly before `target`, found by
+// bisecting on the sample numbers coded in frame headers. A candidate
+// header counts only if its frame's CRC-16 closes on a header that
+// continues the numbering, so sync patterns inside audio data are skipped.
+static void flac_seek(const flac_stream_t* fs, int64_t target, size_t* pos, int64_t* sample) {
+    const uint8_t* buf = fs->buf;
+    // generous bound on one frame: 32 bits per sample plus headers
+    const size_t max_frame = (size_t)fs->si.channels * fs->si.max_block * 4 + 64;
+    size_t lo = fs->first_frame, hi = fs->size;
+    int64_t lo_sample = 0;
+    while (hi - lo > FLAC_SEEK_SPAN) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t found = 0;
+        int64_t found_sample = -1;
+        flac_frame_header_t h, next;
+        for (size_t q = mid; q + 1 < hi; q++) {
+            if (!flac_is_sync(buf + q) || flac_parse_frame_header(buf + q, fs->size - q, &fs->si, &h) != 0) continue;
+            size_t limit = fs->size - q > max_frame ? q + max_frame : fs->size;
+            size_t end = flac_frame_end(buf, limit, q, &fs->si, h.header_len);
+            int64_t first = h.first_sample - fs->sample_base;
+            if (end == fs->size ||
+                (end < limit && flac_parse_frame_header(buf + end, fs->size - end, &fs->si, &next) == 0 &&
+                 next.first_sample - fs->sample_base == first + h.block_size)) {
+                found = q;
+                found_sample = first;
+                break;
+            }
+        }
+        if (found_sample < 0 || found_sample > target) {
+            hi = mid;
+        } else {
+            lo = found;
+            lo_sample = found_sample;
+        }
+    }
+    *pos = lo;
+    *sample = lo_sample;
+}
+
+static int flac_is_stream(const uint8_t* buf, size_t size) {
+    return (size >= 4 && memcmp(buf, "fLaC", 4) == 0) || (size >= 3 && memcmp(buf, "ID3", 3) == 0);
+}
+
+// Parse the metadata of a FLAC image and find its first frame. Returns 0
+// on success.
+static int flac_open(const uint8_t* buf, size_t size, flac_stream_t* fs) {
+    memset(fs, 0, sizeof(*fs));
+    size_t pos = flac_parse_metadata(buf, size, &fs->si);
+    if (pos == 0 || fs->si.channels > FLAC_MAX_CHANNELS) return -1;
+    flac_frame_header_t h;
+    memset(&h, 0, sizeof(h));
+    // resync to the first valid header
+    while (pos + 2 <= size && flac_parse_frame_header(buf + pos, size - pos, &fs->si, &h) != 0) pos++;
+    fs->buf = buf;
+    fs->size = size;
+    fs->first_frame = pos;
+    fs->sample_base = h.first_sample;
+    // The length comes from the last frames rather than STREAMINFO, which
+    // may be zero (encoded from a pipe) or stale.
+    size_t last;
+    int64_t sample;
+    flac_seek(fs, INT64_MAX, &last, &sample);
+    int n = 0;
+    flac_frame_ref_t* frames = flac_scan_frames(fs, last, sample, INT64_MAX, &n);
+    if (!frames) return -1;
+    fs->total = n > 0 ? frames[n - 1].first_sample + frames[n - 1].block_size : sample;
+    free(frames);
+    return 0;
+}
+
+// Parse a WAV image in place, or open a FLAC one for decoding on demand
+// through `flac`, which must outlive `info`.
+static int audio_parse(const uint8_t* buf, size_t size, wav_info_t* info, flac_stream_t* flac) {
+    if (!flac_is_stream(buf, size)) return wav_parse(buf, size, info);
+    memset(info, 0, sizeof(*info));
+    if (flac_open(buf, size, flac) != 0) return -1;
+    info->audio_format = WAVE_FORMAT_IEEE_FLOAT;
+    info->num_channels = flac->si.channels;
+    info->sample_rate = flac->si.sample_rate;
+    info->bits_per_sample = 32;
+    info->sample_format = SAMPLE_F32;
+    info->frame_bytes = (size_t)4 * flac->si.channels;
+    info->data_size = (size_t)flac->total * info->frame_bytes;
+    info->flac = flac;
+    return 0;
+}
+
+// --- PCM conversion kernels ---
+//
+// Interleaved frames -> mono float32, one kernel family per sample format.
+// The full-scale factor and the 1/N channel average are folded into one
+// multiply. Vector variants are picked once at runtime from the
+// ggml_cpu_has_* probes.
+
+typedef void (*pcm_kernel_t)(const uint8_t* src, int num_channels, size_t n_frames, float* dst);
+
+static void pcm_s16_mono_scalar(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 32768.0f;
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = (float)rd_i16(src + 2 * i) * scale;
+    }
+}
+
+static void pcm_s16_stereo_scalar(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 65536.0f;
+    for (size_t i = 0; i < n; i++) {
+        int32_t sum = (int32_t)rd_i16(src + 4 * i) + rd_i16(src + 4 * i + 2);
+        dst[i] = (float)sum * scale;
+    }
+}
+
+static void pcm_s16_multi_scalar(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / (32768.0f * num_channels);
+    const size_t frame_bytes = 2 * (size_t)num_channels;
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t* frame = src + i * frame_bytes;
+        int32_t sum = 0;
+        for (int c = 0; c < num_channels; c++) {
+            sum += rd_i16(frame + 2 * c);
+        }
+        dst[i] = (float)sum * scale;
+    }
+}
+
+static inline int32_t ld_u8(const uint8_t* p) { return (int32_t)p[0] - 128; }
+
+// Scalar N-channel kernels for the non-int16 formats, and mono ones for
+// those that need a conversion (mono f32 is a plain copy).
+#define PCM_MONO_SCALAR_KERNEL(name, bytes, load, scale)                                  \
+    static void pcm_##name##_mono_scalar(const uint8_t* src, int num_channels, size_t n, float* dst) { \
+        for (size_t i = 0; i < n; i++) {                                                  \
+            dst[i] = (float)load(src + (bytes) * i) * (scale);                            \
+        }                                                                                 \
+    }
+
+#define PCM_MULTI_SCALAR_KERNEL(name, bytes, load, scale)                                 \
+    static void pcm_##name##_multi_scalar(const uint8_t* src, int num_channels, size_t n, float* dst) { \
+        const float s = (scale) / num_channels;                                           \
+        const size_t frame_bytes = (size_t)(bytes) * num_channels;                        \
+        for (size_t i = 0; i < n; i++) {                                                  \
+            const uint8_t* frame = src + i * frame_bytes;                                 \
+            float sum = 0.0f;                                                             \
+            for (int c = 0; c < num_channels; c++) {                                      \
+                sum += (float)load(frame + (bytes) * c);                                  \
+            }                                                                             \
+            dst[i] = sum * s;                                                             \
+        }                                                                                 \
+    }
+
+PCM_MONO_SCALAR_KERNEL(u8, 1, ld_u8, 1.0f / 128.0f)
+PCM_MONO_SCALAR_KERNEL(s24, 3, rd_s24, 1.0f / 8388608.0f)
+PCM_MONO_SCALAR_KERNEL(s32, 4, rd_i32, 1.0f / 2147483648.0f)
+PCM_MULTI_SCALAR_KERNEL(u8, 1, ld_u8, 1.0f / 128.0f)
+PCM_MULTI_SCALAR_KERNEL(s24, 3, rd_s24, 1.0f / 8388608.0f)
+PCM_MULTI_SCALAR_KERNEL(s32, 4, rd_i32, 1.0f / 2147483648.0f)
+PCM_MULTI_SCALAR_KERNEL(f32, 4, rd_f32, 1.0f)
+
+static void pcm_f32_mono_copy(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    memcpy(dst, src, n * sizeof(float));
+}
+
+#if defined(STUB_X86)
+__attribute__((target("avx2")))
+static void pcm_s16_mono_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+        __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(f, scale));
+    }
+    pcm_s16_mono_scalar(src + 2 * i, num_channels, n - i, dst + i);
+}
+
+// madd against all-ones sums each adjacent L/R pair into one int32 lane.
+__attribute__((target("avx2")))
+static void pcm_s16_stereo_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 65536.0f);
+    const __m256i ones = _mm256_set1_epi16(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + 4 * i));
+        __m256 f = _mm256_cvtepi32_ps(_mm256_madd_epi16(s, ones));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(f, scale));
+    }
+    pcm_s16_stereo_scalar(src + 4 * i, num_channels, n - i, dst + i);
+}
+
+// One gather per channel fetches its sample from 8 frames into the low half
+// of each 32-bit lane; shifting it up and back sign-extends it.
+__attribute__((target("avx2")))
+static void pcm_s16_multi_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / (32768.0f * num_channels));
+    const int frame_bytes = 2 * num_channels;
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(frame_bytes));
+    size_t i = 0;
+    // each gather reads 4 bytes for a 2-byte sample; stay a frame clear of the end
+    for (; i + 9 <= n; i += 8) {
+        const uint8_t* block = src + i * frame_bytes;
+        __m256i sum = _mm256_setzero_si256();
+        for (int c = 0; c < num_channels; c++) {
+            __m256i v = _mm256_i32gather_epi32((const int*)(block + 2 * c), offsets, 1);
+            sum = _mm256_add_epi32(sum, _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16));
+        }
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(sum), scale));
+    }
+    pcm_s16_multi_scalar(src + i * frame_bytes, num_channels, n - i, dst + i);
+}
+
+// 5.1: madd sums the channel pairs (0,1) (2,3) (4,5) of 8 frames into 24
+// lanes over three registers. Frame f's pairs are lanes 3f, 3f + 1, 3f + 2;
+// round k permutes lane (3f + k) % 8 of each register into lane f and blends
+// in the register that lane falls in.
+__attribute__((target("avx2")))
+static void pcm_s16_6ch_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / (32768.0f * 6));
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i idx0 = _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5);
+    const __m256i idx1 = _mm256_setr_epi32(1, 4, 7, 2, 5, 0, 3, 6);
+    const __m256i idx2 = _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const uint8_t* block = src + 12 * i;
+        __m256i a = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)block), ones);
+        __m256i b = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(block + 32)), ones);
+        __m256i c = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(block + 64)), ones);
+        __m256i r0 = _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(a, idx0), _mm256_permutevar8x32_epi32(b, idx0), 0x38),
+                                        _mm256_permutevar8x32_epi32(c, idx0), 0xC0);
+        __m256i r1 = _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(a, idx1), _mm256_permutevar8x32_epi32(b, idx1), 0x18),
+                                        _mm256_permutevar8x32_epi32(c, idx1), 0xE0);
+        __m256i r2 = _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(a, idx2), _mm256_permutevar8x32_epi32(b, idx2), 0x1C),
+                                        _mm256_permutevar8x32_epi32(c, idx2), 0xE0);
+        __m256i sum = _mm256_add_epi32(_mm256_add_epi32(r0, r1), r2);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(sum), scale));
+    }
+    pcm_s16_multi_scalar(src + 12 * i, num_channels, n - i, dst + i);
+}
+
+__attribute__((target("avx512f")))
+static void pcm_s16_mono_avx512(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m512 scale = _mm512_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + 2 * i));
+        __m512 f = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(s));
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(f, scale));
+    }
+    pcm_s16_mono_scalar(src + 2 * i, num_channels, n - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void pcm_u8_mono_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 128.0f);
+    const __m256i bias = _mm256_set1_epi32(128);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadl_epi64((const __m128i*)(src + i));
+        __m256i v = _mm256_sub_epi32(_mm256_cvtepu8_epi32(s), bias);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    pcm_u8_mono_scalar(src + i, num_channels, n - i, dst + i);
+}
+
+// Four packed 24-bit samples are shuffled into the top three bytes of each
+// 32-bit lane, then an arithmetic shift sign-extends them.
+__attribute__((target("avx2")))
+static void pcm_s24_mono_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 8388608.0f);
+    const __m128i shuf = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    size_t i = 0;
+    // each 16-byte load covers 4 samples (12 bytes); stay 4 bytes clear of the end
+    for (; i + 10 <= n; i += 8) {
+        __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 3 * i)), shuf);
+        __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 3 * i + 12)), shuf);
+        __m256i v = _mm256_srai_epi32(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), 8);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    pcm_s24_mono_scalar(src + 3 * i, num_channels, n - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void pcm_s32_mono_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + 4 * i));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    pcm_s32_mono_scalar(src + 4 * i, num_channels, n - i, dst + i);
+}
+
+// The bytes are widened to int16 so madd sums each L/R pair; the two 128
+// offsets come off together.
+__attribute__((target("avx2")))
+static void pcm_u8_stereo_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 128.0f / 2);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i bias = _mm256_set1_epi32(256);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+        __m256i v = _mm256_sub_epi32(_mm256_madd_epi16(_mm256_cvtepu8_epi16(s), ones), bias);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    pcm_u8_multi_scalar(src + 2 * i, num_channels, n - i, dst + i);
+}
+
+// Samples are unpacked as in the mono kernel and converted to float before
+// the L/R pairs are summed like f32 stereo, as the scalar kernel rounds.
+__attribute__((target("avx2")))
+static void pcm_s24_stereo_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 8388608.0f / 2);
+    const __m128i shuf = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    size_t i = 0;
+    // the last 16-byte load ends 4 bytes past the 8 frames; stay a frame clear
+    for (; i + 9 <= n; i += 8) {
+        const uint8_t* p = src + 6 * i;
+        __m128i s0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), shuf);
+        __m128i s1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 12)), shuf);
+        __m128i s2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 24)), shuf);
+        __m128i s3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 36)), shuf);
+        __m256 a = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_inserti128_si256(_mm256_castsi128_si256(s0), s1, 1), 8));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_inserti128_si256(_mm256_castsi128_si256(s2), s3, 1), 8));
+        __m256 h = _mm256_hadd_ps(a, b);
+        h = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), 0xD8));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(h, scale));
+    }
+    pcm_s24_multi_scalar(src + 6 * i, num_channels, n - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void pcm_s32_stereo_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f / 2);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(src + 8 * i)));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(src + 8 * i + 32)));
+        __m256 h = _mm256_hadd_ps(a, b);
+        h = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), 0xD8));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(h, scale));
+    }
+    pcm_s32_multi_scalar(src + 8 * i, num_channels, n - i, dst + i);
+}
+
+// hadd sums L/R pairs within 128-bit lanes; the permute restores frame order.
+__attribute__((target("avx2")))
+static void pcm_f32_stereo_avx2(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const __m256 half = _mm256_set1_ps(0.5f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps((const float*)(src + 8 * i));
+        __m256 b = _mm256_loadu_ps((const float*)(src + 8 * i + 32));
+        __m256 h = _mm256_hadd_ps(a, b);
+        h = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), 0xD8));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(h, half));
+    }
+    pcm_f32_multi_scalar(src + 8 * i, num_channels, n - i, dst + i);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void pcm_s16_mono_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 32768.0f;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t s = vld1q_s16((const int16_t*)(src + 2 * i));
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+        vst1q_f32(dst + i, vmulq_n_f32(lo, scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(hi, scale));
+    }
+    pcm_s16_mono_scalar(src + 2 * i, num_channels, n - i, dst + i);
+}
+
+// vld2 de-interleaves L/R; vaddl widens while summing.
+static void pcm_s16_stereo_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 65536.0f;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8x2_t s = vld2q_s16((const int16_t*)(src + 4 * i));
+        int32x4_t lo = vaddl_s16(vget_low_s16(s.val[0]), vget_low_s16(s.val[1]));
+        int32x4_t hi = vaddl_s16(vget_high_s16(s.val[0]), vget_high_s16(s.val[1]));
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(lo), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(hi), scale));
+    }
+    pcm_s16_stereo_scalar(src + 4 * i, num_channels, n - i, dst + i);
+}
+
+// Four frames at a time: each channel's samples are loaded lane by lane
+// along the frame stride and widened into the running sums.
+static void pcm_s16_multi_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / (32768.0f * num_channels);
+    const size_t frame_bytes = 2 * (size_t)num_channels;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const int16_t* p = (const int16_t*)(src + i * frame_bytes);
+        int32x4_t sum = vdupq_n_s32(0);
+        for (int c = 0; c < num_channels; c++) {
+            int16x4_t v = vdup_n_s16(0);
+            v = vld1_lane_s16(p + c, v, 0);
+            v = vld1_lane_s16(p + num_channels + c, v, 1);
+            v = vld1_lane_s16(p + 2 * num_channels + c, v, 2);
+            v = vld1_lane_s16(p + 3 * num_channels + c, v, 3);
+            sum = vaddw_s16(sum, v);
+        }
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(sum), scale));
+    }
+    pcm_s16_multi_scalar(src + i * frame_bytes, num_channels, n - i, dst + i);
+}
+
+// 5.1: vld3 splits 4 frames into lanes of channels (0,3), (1,4), (2,5), so
+// the three sum to half-frames; vuzp pairs up the halves of each frame.
+static void pcm_s16_6ch_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / (32768.0f * 6);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int16x8x3_t s = vld3q_s16((const int16_t*)(src + 12 * i));
+        int32x4_t lo = vaddw_s16(vaddl_s16(vget_low_s16(s.val[0]), vget_low_s16(s.val[1])), vget_low_s16(s.val[2]));
+        int32x4_t hi = vaddw_s16(vaddl_s16(vget_high_s16(s.val[0]), vget_high_s16(s.val[1])), vget_high_s16(s.val[2]));
+        int32x4x2_t halves = vuzpq_s32(lo, hi);
+        int32x4_t sum = vaddq_s32(halves.val[0], halves.val[1]);
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(sum), scale));
+    }
+    pcm_s16_multi_scalar(src + 12 * i, num_channels, n - i, dst + i);
+}
+
+static void pcm_s32_mono_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 2147483648.0f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t v = vld1q_s32((const int32_t*)(src + 4 * i));
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(v), scale));
+    }
+    pcm_s32_mono_scalar(src + 4 * i, num_channels, n - i, dst + i);
+}
+
+static void pcm_u8_mono_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 128.0f;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(src + i), vdup_n_u8(128)));
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+    }
+    pcm_u8_mono_scalar(src + i, num_channels, n - i, dst + i);
+}
+
+// vld2 de-interleaves L/R; the sum minus both 128 offsets fits int16.
+static void pcm_u8_stereo_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 128.0f / 2;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x2_t s = vld2_u8(src + 2 * i);
+        int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vaddl_u8(s.val[0], s.val[1])), vdupq_n_s16(256));
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+    }
+    pcm_u8_multi_scalar(src + 2 * i, num_channels, n - i, dst + i);
+}
+
+// vld3 splits 8 packed 24-bit samples into their low, middle and high bytes;
+// the sign-extended high byte is shifted over the other two.
+static inline void pcm_s24_load8_neon(const uint8_t* p, int32x4_t* lo, int32x4_t* hi) {
+    uint8x8x3_t b = vld3_u8(p);
+    uint16x8_t low16 = vorrq_u16(vmovl_u8(b.val[0]), vshll_n_u8(b.val[1], 8));
+    int16x8_t top = vmovl_s8(vreinterpret_s8_u8(b.val[2]));
+    *lo = vorrq_s32(vshll_n_s16(vget_low_s16(top), 16), vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(low16))));
+    *hi = vorrq_s32(vshll_n_s16(vget_high_s16(top), 16), vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(low16))));
+}
+
+static void pcm_s24_mono_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 8388608.0f;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo, hi;
+        pcm_s24_load8_neon(src + 3 * i, &lo, &hi);
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(lo), scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(hi), scale));
+    }
+    pcm_s24_mono_scalar(src + 3 * i, num_channels, n - i, dst + i);
+}
+
+// Four frames per vld3; vuzp separates L from R after the float conversion.
+static void pcm_s24_stereo_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 8388608.0f / 2;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t lo, hi;
+        pcm_s24_load8_neon(src + 6 * i, &lo, &hi);
+        float32x4x2_t lr = vuzpq_f32(vcvtq_f32_s32(lo), vcvtq_f32_s32(hi));
+        vst1q_f32(dst + i, vmulq_n_f32(vaddq_f32(lr.val[0], lr.val[1]), scale));
+    }
+    pcm_s24_multi_scalar(src + 6 * i, num_channels, n - i, dst + i);
+}
+
+static void pcm_s32_stereo_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    const float scale = 1.0f / 2147483648.0f / 2;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32x4x2_t v = vld2q_s32((const int32_t*)(src + 8 * i));
+        float32x4_t sum = vaddq_f32(vcvtq_f32_s32(v.val[0]), vcvtq_f32_s32(v.val[1]));
+        vst1q_f32(dst + i, vmulq_n_f32(sum, scale));
+    }
+    pcm_s32_multi_scalar(src + 8 * i, num_channels, n - i, dst + i);
+}
+
+// vld2 de-interleaves L/R.
+static void pcm_f32_stereo_neon(const uint8_t* src, int num_channels, size_t n, float* dst) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4x2_t v = vld2q_f32((const float*)(src + 8 * i));
+        vst1q_f32(dst + i, vmulq_n_f32(vaddq_f32(v.val[0], v.val[1]), 0.5f));
+    }
+    pcm_f32_multi_scalar(src + 8 * i, num_channels, n - i, dst + i);
+}
+#endif
+
+static pcm_kernel_t g_pcm_s16_mono = pcm_s16_mono_scalar;
+static pcm_kernel_t g_pcm_s16_stereo = pcm_s16_stereo_scalar;
+static pcm_kernel_t g_pcm_s16_multi = pcm_s16_multi_scalar;
+static pcm_kernel_t g_pcm_s16_6ch = pcm_s16_multi_scalar;
+static pcm_kernel_t g_pcm_u8_mono = pcm_u8_mono_scalar;
+static pcm_kernel_t g_pcm_u8_stereo = pcm_u8_multi_scalar;
+static pcm_kernel_t g_pcm_s24_mono = pcm_s24_mono_scalar;
+static pcm_kernel_t g_pcm_s24_stereo = pcm_s24_multi_scalar;
+static pcm_kernel_t g_pcm_s32_mono = pcm_s32_mono_scalar;
+static pcm_kernel_t g_pcm_s32_stereo = pcm_s32_multi_scalar;
+static pcm_kernel_t g_pcm_f32_stereo = pcm_f32_multi_scalar;
+static pthread_once_t g_pcm_kernels_once = PTHREAD_ONCE_INIT;
+
+static void pcm_kernels_init(void) {
+#if defined(STUB_X86)
+    if (ggml_cpu_has_avx2()) {
+        g_pcm_s16_mono = pcm_s16_mono_avx2;
+        g_pcm_s16_stereo = pcm_s16_stereo_avx2;
+        g_pcm_s16_multi = pcm_s16_multi_avx2;
+        g_pcm_s16_6ch = pcm_s16_6ch_avx2;
+        g_pcm_u8_mono = pcm_u8_mono_avx2;
+        g_pcm_u8_stereo = pcm_u8_stereo_avx2;
+        g_pcm_s24_mono = pcm_s24_mono_avx2;
+        g_pcm_s24_stereo = pcm_s24_stereo_avx2;
+        g_pcm_s32_mono = pcm_s32_mono_avx2;
+        g_pcm_s32_stereo = pcm_s32_stereo_avx2;
+        g_pcm_f32_stereo = pcm_f32_stereo_avx2;
+    }
+    if (ggml_cpu_has_avx512()) {
+        g_pcm_s16_mono = pcm_s16_mono_avx512;
+    }
+#endif
+#if defined(__ARM_NEON)
+    if (ggml_cpu_has_neon()) {
+        g_pcm_s16_mono = pcm_s16_mono_neon;
+        g_pcm_s16_stereo = pcm_s16_stereo_neon;
+        g_pcm_s16_multi = pcm_s16_multi_neon;
+        g_pcm_s16_6ch = pcm_s16_6ch_neon;
+        g_pcm_u8_mono = pcm_u8_mono_neon;
+        g_pcm_u8_stereo = pcm_u8_stereo_neon;
+        g_pcm_s24_mono = pcm_s24_mono_neon;
+        g_pcm_s24_stereo = pcm_s24_stereo_neon;
+        g_pcm_s32_mono = pcm_s32_mono_neon;
+        g_pcm_s32_stereo = pcm_s32_stereo_neon;
+        g_pcm_f32_stereo = pcm_f32_stereo_neon;
+    }
+#endif
+}
+
+static pcm_kernel_t pcm_s16_kernel(int num_channels, int simd) {
+    pthread_once(&g_pcm_kernels_once, pcm_kernels_init);
+    switch (num_channels) {
+        case 1: return simd ? g_pcm_s16_mono : pcm_s16_mono_scalar;
+        case 2: return simd ? g_pcm_s16_stereo : pcm_s16_stereo_scalar;
+        case 6: return simd ? g_pcm_s16_6ch : pcm_s16_multi_scalar;
+        default: return simd ? g_pcm_s16_multi : pcm_s16_multi_scalar;
+    }
+}
+
+// Convert one channel of interleaved frames, without downmixing.
+static void pcm_extract_channel(const wav_info_t* info, int channel, const uint8_t* src, size_t n, float* dst) {
+    const size_t stride = info->frame_bytes;
+    const uint8_t* p = src + stride / info->num_channels * channel;
+    switch (info->sample_format) {
+        case SAMPLE_U8:
+            for (size_t i = 0; i < n; i++) dst[i] = (float)ld_u8(p + i * stride) * (1.0f / 128.0f);
+            break;
+        case SAMPLE_S16:
+            for (size_t i = 0; i < n; i++) dst[i] = (float)rd_i16(p + i * stride) * (1.0f / 32768.0f);
+            break;
+        case SAMPLE_S24:
+            for (size_t i = 0; i < n; i++) dst[i] = (float)rd_s24(p + i * stride) * (1.0f / 8388608.0f);
+            break;
+        case SAMPLE_S32:
+            for (size_t i = 0; i < n; i++) dst[i] = (float)rd_i32(p + i * stride) * (1.0f / 2147483648.0f);
+            break;
+        case SAMPLE_F32:
+            for (size_t i = 0; i < n; i++) dst[i] = rd_f32(p + i * stride);
+            break;
+    }
+}
+
+// Kernel converting frames of `info`'s format to mono, or NULL if unsupported.
+static pcm_kernel_t pcm_kernel(const wav_info_t* info) {
+    pthread_once(&g_pcm_kernels_once, pcm_kernels_init);
+    const int mono = info->num_channels == 1;
+    const int stereo = info->num_channels == 2;
+    switch (info->sample_format) {
+        case SAMPLE_U8: return mono ? g_pcm_u8_mono : stereo ? g_pcm_u8_stereo : pcm_u8_multi_scalar;
+        case SAMPLE_S16: return pcm_s16_kernel(info->num_channels, 1);
+        case SAMPLE_S24: return mono ? g_pcm_s24_mono : stereo ? g_pcm_s24_stereo : pcm_s24_multi_scalar;
+        case SAMPLE_S32: return mono ? g_pcm_s32_mono : stereo ? g_pcm_s32_stereo : pcm_s32_multi_scalar;
+        case SAMPLE_F32:
+            if (mono) return pcm_f32_mono_copy;
+            return stereo ? g_pcm_f32_stereo : pcm_f32_multi_scalar;
+        default: return NULL;
+    }
+}
+
+// Microbenchmark: throughput of the int16 -> mono float conversion in GB/s
+// of source PCM, for the scalar (simd == 0) or the dispatched kernel.
+double whisper_bench_pcm_convert(int32_t num_channels, int32_t simd) {
+    if (num_channels < 1) num_channels = 1;
+    const size_t n_frames = 1 << 20;
+    const int iters = 32;
+    size_t src_bytes = n_frames * 2 * (size_t)num_channels;
+    uint8_t* src = (uint8_t*)malloc(src_bytes);
+    float* dst = (float*)malloc(n_frames * sizeof(float));
+    if (!src || !dst) {
+        free(src);
+        free(dst);
+        return 0.0;
+    }
+    for (size_t i = 0; i < src_bytes; i++) src[i] = (uint8_t)(i * 131u);
+    pcm_kernel_t k = pcm_s16_kernel(num_channels, simd);
+    k(src, num_channels, n_frames, dst);  // warm caches / page in
+    double t0 = now_ms();
+    for (int it = 0; it < iters; it++) {
+        k(src, num_channels, n_frames, dst);
+    }
+    double elapsed = now_ms() - t0;
+    free(src);
+    free(dst);
+    return elapsed > 0.0 ? (double)src_bytes * iters / (elapsed * 1e6) : 0.0;
+}
+
+// --- Polyphase resampler (any rate -> 16kHz) ---
+//
+// For in_rate/16000 reduced to M/L, output n sits at input time n*M/L. Each
+// of the L fractional positions ("phases") gets its own precomputed
+// Kaiser-windowed sinc of `taps` coefficients, so producing a sample is a
+// single dot product. Banks are built on first use per (rate, quality) and
+// cached for the life of the process.
+
+enum {
+    RESAMPLE_LINEAR = 0,  // legacy 2-tap interpolation, no anti-aliasing
+    RESAMPLE_FAST = 1,
+    RESAMPLE_BEST = 2,
+};
+
+#define RESAMPLE_MAX_PHASES 4096
+#define RESAMPLE_CACHE_SIZE 16
+// Outputs per thread below which a single thread is used
+#define RESAMPLE_MIN_PER_THREAD (16000 * 30)
+#define RESAMPLE_MAX_THREADS 8
+
+typedef struct {
+    int in_rate;
+    int quality;
+    int L;      // interpolation factor
+    int M;      // decimation factor
+    int taps;   // per phase, multiple of 8
+    float* bank;  // L * taps, phase-major
+} resample_filter_t;
+
+static resample_filter_t g_resample_cache[RESAMPLE_CACHE_SIZE];
+static int g_resample_cache_len = 0;
+static pthread_mutex_t g_resample_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int gcd_int(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth-order modified Bessel function, for the Kaiser window.
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0, q = x * x / 4.0;
+    for (int k = 1; k < 64; k++) {
+        term *= q / ((double)k * k);
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+static int resample_filter_build(resample_filter_t* f, int in_rate, int quality) {
+    int g = gcd_int(in_rate, 16000);
+    int L = 16000 / g;
+    int M = in_rate / g;
+    if (L > RESAMPLE_MAX_PHASES) return -1;
+
+    // zero crossings per side, Kaiser beta and passband edge (of output Nyquist)
+    double zc = quality == RESAMPLE_BEST ? 24.0 : 8.0;
+    double beta = quality == RESAMPLE_BEST ? 9.0 : 6.0;
+    double rolloff = quality == RESAMPLE_BEST ? 0.95 : 0.90;
+    double fc = (L < M ? (double)L / M : 1.0) * rolloff;
+    double half = zc / fc;
+    int taps = ((int)ceil(2.0 * half) + 7) & ~7;
+    if (quality == RESAMPLE_LINEAR) {
+        taps = 8;
+    }
+
+    float* bank = (float*)calloc((size_t)L * taps, sizeof(float));
+    if (!bank) return -1;
+    if (quality == RESAMPLE_LINEAR) {
+        // 2-tap triangle: same output as the direct linear path, but usable
+        // by the streaming reader's carried-history convolution.
+        for (int p = 0; p < L; p++) {
+            bank[(size_t)p * taps + taps / 2 - 1] = 1.0f - (float)p / L;
+            bank[(size_t)p * taps + taps / 2] = (float)p / L;
+        }
+    } else {
+        double i0_beta = bessel_i0(beta);
+        for (int p = 0; p < L; p++) {
+            float* g_p = bank + (size_t)p * taps;
+            double sum = 0.0;
+            for (int k = 0; k < taps; k++) {
+                double u = (double)p / L + taps / 2 - 1 - k;
+                double w = 0.0;
+                if (fabs(u) < half) {
+                    double x = fc * u;
+                    double sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+                    double r = u / half;
+                    w = fc * sinc * bessel_i0(beta * sqrt(1.0 - r * r)) / i0_beta;
+                }
+                g_p[k] = (float)w;
+                sum += w;
+            }
+            // unity DC gain for every phase
+            for (int k = 0; k < taps; k++) g_p[k] = (float)(g_p[k] / sum);
+        }
+    }
+    f->in_rate = in_rate;
+    f->quality = quality;
+    f->L = L;
+    f->M = M;
+    f->taps = taps;
+    f->bank = bank;
+    return 0;
+}
+
+// Cached filter for (in_rate, quality), or NULL if the ratio is unsupported.
+static const resample_filter_t* resample_filter_get(int in_rate, int quality) {
+    const resample_filter_t* found = NULL;
+    pthread_mutex_lock(&g_resample_lock);
+    for (int i = 0; i < g_resample_cache_len; i++) {
+        if (g_resample_cache[i].in_rate == in_rate && g_resample_cache[i].quality == quality) {
+            found = &g_resample_cache[i];
+            break;
+        }
+    }
+    if (!found && g_resample_cache_len < RESAMPLE_CACHE_SIZE) {
+        resample_filter_t* f = &g_resample_cache[g_resample_cache_len];
+        if (resample_filter_build(f, in_rate, quality) == 0) {
+            g_resample_cache_len++;
+            found = f;
+        }
+    }
+    pthread_mutex_unlock(&g_resample_lock);
+    return found;
+}
+
+typedef float (*dot_kernel_t)(const float* x, const float* g, int n);
+
+static float dot_scalar(const float* x, const float* g, int n) {
+    float acc[8] = {0};
+    for (int k = 0; k < n; k += 8) {
+        for (int j = 0; j < 8; j++) acc[j] += x[k + j] * g[k + j];
+    }
+    return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+#if defined(STUB_X86)
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float* x, const float* g, int n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int k = 0;
+    for (; k + 16 <= n; k += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(g + k), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + k + 8), _mm256_loadu_ps(g + k + 8), acc1);
+    }
+    if (k < n) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(g + k), acc0);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static float dot_neon(const float* x, const float* g, int n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (int k = 0; k < n; k += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(x + k), vld1q_f32(g + k));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(x + k + 4), vld1q_f32(g + k + 4));
+    }
+    float32x4_t acc = vaddq_f32(acc0, acc1);
+    float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+#endif
+
+static dot_kernel_t g_dot = dot_scalar;
+static pthread_once_t g_dot_once = PTHREAD_ONCE_INIT;
+
+static void dot_kernel_init(void) {
+#if defined(STUB_X86)
+    if (ggml_cpu_has_avx2() && ggml_cpu_has_fma()) g_dot = dot_avx2;
+#endif
+#if defined(__ARM_NEON)
+    if (ggml_cpu_has_neon()) g_dot = dot_neon;
+#endif
+}
+
+static dot_kernel_t dot_kernel(void) {
+    pthread_once(&g_dot_once, dot_kernel_init);
+    return g_dot;
+}
+
+// Produce outputs [n0, n1) into y[0, n1 - n0). x holds the mono input from
+// index x0 on, covering at least the filter support of those outputs that
+// lies inside [0, n_in); input outside [0, n_in) reads as zero.
+static void resample_range(const resample_filter_t* f, const float* x, int64_t x0, int64_t n_in, float* y, int64_t n0, int64_t n1) {
+    const int L = f->L, M = f->M, K = f->taps;
+    const dot_kernel_t dot = dot_kernel();
+    int64_t i = (n0 * M) / L;  // integer input position
+    int p = (int)((n0 * M) % L);  // phase
+    const int64_t di = M / L;
+    const int dp = M % L;
+    for (int64_t n = n0; n < n1; n++) {
+        const float* g = f->bank + (size_t)p * K;
+        int64_t start = i - K / 2 + 1;
+        if (start >= 0 && start + K <= n_in) {
+            y[n - n0] = dot(x + (start - x0), g, K);
+        } else {
+            // edges: samples outside the input are zero
+            float acc = 0.0f;
+            for (int k = 0; k < K; k++) {
+                int64_t j = start + k;
+                if (j >= 0 && j < n_in) acc += x[j - x0] * g[k];
+            }
+            y[n - n0] = acc;
+        }
+        i += di;
+        p += dp;
+        if (p >= L) {
+            p -= L;
+            i++;
+        }
+    }
+}
+
+typedef struct {
+    const resample_filter_t* f;
+    const float* x;
+    int64_t x0;
+    int64_t n_in;
+    float* y;
+    int64_t n0;
+    int64_t n1;
+} resample_job_t;
+
+static void* resample_worker(void* arg) {
+    resample_job_t* job = (resample_job_t*)arg;
+    resample_range(job->f, job->x, job->x0, job->n_in, job->y, job->n0, job->n1);
+    return NULL;
+}
+
+static int64_t resample_out_count(int64_t n_in, int in_rate) {
+    return n_in * 16000 / in_rate;
+}
+
+// Input window [*i0, *i1) that outputs [n0, n1) of a filter over n_in input
+// samples read, clamped to the input.
+static void resample_support(const resample_filter_t* f, int64_t n_in, int64_t n0, int64_t n1, int64_t* i0, int64_t* i1) {
+    const int K = f->taps;
+    int64_t lo = n1 > n0 ? (n0 * f->M) / f->L - K / 2 + 1 : 0;
+    int64_t hi = n1 > n0 ? ((n1 - 1) * f->M) / f->L + K / 2 + 1 : 0;
+    *i0 = lo < 0 ? 0 : lo > n_in ? n_in : lo;
+    *i1 = hi < *i0 ? *i0 : hi > n_in ? n_in : hi;
+}
+
+// Resample outputs [n0, n1) into y, splitting long ranges across threads.
+// x holds input from index x0 on (see resample_range). Returns 0 on success.
+static int resample_polyphase_range(const float* x, int64_t x0, int64_t n_in, int in_rate, int quality, float* y, int64_t n0, int64_t n1) {
+    const resample_filter_t* f = resample_filter_get(in_rate, quality);
+    if (!f) return -1;
+    int64_t n_out = n1 - n0;
+
+    long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int n_threads = (int)(n_out / RESAMPLE_MIN_PER_THREAD);
+    if (n_threads > n_cpu) n_threads = (int)n_cpu;
+    if (n_threads > RESAMPLE_MAX_THREADS) n_threads = RESAMPLE_MAX_THREADS;
+    if (n_threads <= 1) {
+        resample_range(f, x, x0, n_in, y, n0, n1);
+        return 0;
+    }
+
+    pthread_t threads[RESAMPLE_MAX_THREADS];
+    resample_job_t jobs[RESAMPLE_MAX_THREADS];
+    int started[RESAMPLE_MAX_THREADS] = {0};
+    int64_t per = (n_out + n_threads - 1) / n_threads;
+    for (int t = 0; t < n_threads; t++) {
+        int64_t b0 = per * t < n_out ? per * t : n_out;
+        int64_t b1 = b0 + per < n_out ? b0 + per : n_out;
+        jobs[t] = (resample_job_t){ f, x, x0, n_in, y + b0, n0 + b0, n0 + b1 };
+        if (t > 0 && pthread_create(&threads[t], NULL, resample_worker, &jobs[t]) == 0) {
+            started[t] = 1;
+        }
+    }
+    resample_worker(&jobs[0]);
+    for (int t = 1; t < n_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            resample_worker(&jobs[t]);
+        }
+    }
+    return 0;
+}
+
+// n frames at src to mono float: the downmix kernel, or one channel when
+// channel >= 0.
+static void wav_convert(const wav_info_t* info, pcm_kernel_t convert, int channel, const uint8_t* src, size_t n, float* dst) {
+    if (channel < 0) {
+        convert(src, info->num_channels, n, dst);
+    } else {
+        pcm_extract_channel(info, channel, src, n, dst);
+    }
+}
+
+typedef struct {
+    const flac_stream_t* fs;
+    const flac_frame_ref_t* frames;
+    int f0;
+    int f1;
+    int channel;
+    int64_t i0;  // dst[0] is sample i0
+    int64_t i1;
+    float* dst;
+} flac_job_t;
+
+// Decode frames [f0, f1) one at a time, converting the part of each that
+// lies in [i0, i1) straight into the mono output.
+static void* flac_worker(void* arg) {
+    flac_job_t* job = (flac_job_t*)arg;
+    const flac_streaminfo_t* si = &job->fs->si;
+    const int ch = si->channels;
+    wav_info_t pcm;
+    memset(&pcm, 0, sizeof(pcm));
+    pcm.audio_format = WAVE_FORMAT_IEEE_FLOAT;
+    pcm.num_channels = ch;
+    pcm.sample_rate = si->sample_rate;
+    pcm.bits_per_sample = 32;
+    pcm.sample_format = SAMPLE_F32;
+    pcm.frame_bytes = (size_t)4 * ch;
+    const pcm_kernel_t convert = pcm_kernel(&pcm);
+    int32_t* scratch = (int32_t*)malloc((size_t)ch * si->max_block * sizeof(int32_t));
+    float* frame = (float*)malloc((size_t)ch * si->max_block * sizeof(float));
+    for (int f = job->f0; f < job->f1; f++) {
+        const flac_frame_ref_t* fr = &job->frames[f];
+        int64_t a = fr->first_sample > job->i0 ? fr->first_sample : job->i0;
+        int64_t b = fr->first_sample + fr->block_size < job->i1 ? fr->first_sample + fr->block_size : job->i1;
+        if (a >= b) continue;
+        if (!scratch || !frame || flac_decode_frame(job->fs->buf + fr->offset, fr->size, si, scratch, frame) != 0) {
+            // a damaged frame decodes as silence
+            memset(job->dst + (a - job->i0), 0, (size_t)(b - a) * sizeof(float));
+            continue;
+        }
+        const uint8_t* src = (const uint8_t*)(frame + (size_t)(a - fr->first_sample) * ch);
+        wav_convert(&pcm, convert, job->channel, src, (size_t)(b - a), job->dst + (a - job->i0));
+    }
+    free(scratch);
+    free(frame);
+    return NULL;
+}
+
+// Mono samples [i0, i0 + n) of a FLAC stream into dst (downmix, or one
+// channel when channel >= 0): seek to the frame covering i0, index the
+// frames up to i0 + n and decode them in parallel. Samples past the last
+// frame read as zero. Returns 0 on success.
+static int flac_read_mono(const flac_stream_t* fs, int channel, int64_t i0, int64_t n, float* dst) {
+    if (n <= 0) return 0;
+    memset(dst, 0, (size_t)n * sizeof(float));
+    size_t pos;
+    int64_t sample;
+    flac_seek(fs, i0, &pos, &sample);
+    int n_frames = 0;
+    flac_frame_ref_t* frames = flac_scan_frames(fs, pos, sample, i0 + n, &n_frames);
+    if (!frames) return -1;
+
+    long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int n_threads = n_frames / FLAC_MIN_FRAMES_PER_THREAD;
+    if (n_threads > n_cpu) n_threads = (int)n_cpu;
+    if (n_threads > FLAC_MAX_THREADS) n_threads = FLAC_MAX_THREADS;
+    if (n_threads < 1) n_threads = 1;
+    pthread_t threads[FLAC_MAX_THREADS];
+    flac_job_t jobs[FLAC_MAX_THREADS];
+    int started[FLAC_MAX_THREADS] = {0};
+    int per = (n_frames + n_threads - 1) / n_threads;
+    for (int t = 0; t < n_threads; t++) {
+        int f0 = per * t < n_frames ? per * t : n_frames;
+        int f1 = f0 + per < n_frames ? f0 + per : n_frames;
+        jobs[t] = (flac_job_t){ fs, frames, f0, f1, channel, i0, i0 + n, dst };
+        if (t > 0 && pthread_create(&threads[t], NULL, flac_worker, &jobs[t]) == 0) {
+            started[t] = 1;
+        }
+    }
+    flac_worker(&jobs[0]);
+    for (int t = 1; t < n_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            flac_worker(&jobs[t]);
+        }
+    }
+    free(frames);
+    return 0;
+}
+
+// n mono frames from frame i0 on: converted from the WAV data in place, or
+// decoded from the FLAC frames that cover them. Returns 0 on success.
+static int audio_read_mono(const wav_info_t* info, pcm_kernel_t convert, int channel, int64_t i0, int64_t n, float* dst) {
+    if (info->flac) return flac_read_mono(info->flac, channel, i0, n, dst);
+    wav_convert(info, convert, channel, info->data + (size_t)i0 * info->frame_bytes, (size_t)n, dst);
+    return 0;
+}
+
+// Decode the 16kHz window starting offset_ms into the audio and lasting
+// duration_ms (0 = to the end) into a freshly allocated mono buffer, from
+// the downmix of all channels (channel < 0) or from a single channel. Only
+// the frames under that window (plus the resampler's filter support) are
+// converted, so with an mmap'd source only those pages are read; samples are
+// identical to the same range of a whole-file decode. Resampled windows are
+// converted in pieces, so the mono input held at once stays bounded.
+static wav_samples_t* wav_decode_window(const wav_info_t* info, int quality, int64_t offset_ms, int64_t duration_ms, int channel) {
+    const pcm_kernel_t convert = pcm_kernel(info);
+    if (!convert || info->num_channels < 1 || info->sample_rate <= 0) return NULL;
+    if (channel >= info->num_channels) return NULL;
+
+    const size_t frame_bytes = info->frame_bytes;
+    const int64_t num_samples = (int64_t)(info->data_size / frame_bytes);
+    const uint8_t* src = info->data;
+    const int sample_rate = info->sample_rate;
+
+    const int64_t total = resample_out_count(num_samples, sample_rate);
+    int64_t out0 = offset_ms > 0 ? offset_ms * 16 : 0;
+    if (out0 > total) out0 = total;
+    int64_t out1 = duration_ms > 0 ? out0 + duration_ms * 16 : total;
+    if (out1 > total) out1 = total;
+    // count and origin are handed to MoonBit as Int
+    if (out1 > INT_MAX) return NULL;
+
+    const int64_t output_count = out1 - out0;
+    float* output = (float*)malloc((size_t)(output_count > 0 ? output_count : 1) * sizeof(float));
+    if (!output) return NULL;
+    const resample_filter_t* filter = NULL;
+    // FLAC frames can't be read at random, so linear goes through the
+    // 2-tap filter bank too
+    if (sample_rate != 16000 && (quality != RESAMPLE_LINEAR || info->flac)) {
+        filter = resample_filter_get(sample_rate, quality);
+    }
+    int failed = 0;
+    if (sample_rate == 16000) {
+        failed = audio_read_mono(info, convert, channel, out0, output_count, output) != 0;
+    } else if (filter) {
+        const int64_t piece = (int64_t)RESAMPLE_MIN_PER_THREAD * RESAMPLE_MAX_THREADS;
+        const int64_t span = output_count < piece ? output_count : piece;
+        float* mono = (float*)malloc((size_t)(span * filter->M / filter->L + filter->taps + 2) * sizeof(float));
+        failed = mono == NULL;
+        for (int64_t n0 = out0; n0 < out1 && !failed; n0 += piece) {
+            int64_t n1 = n0 + piece < out1 ? n0 + piece : out1;
+            int64_t i0, i1;
+            resample_support(filter, num_samples, n0, n1, &i0, &i1);
+            failed = audio_read_mono(info, convert, channel, i0, i1 - i0, mono) != 0 ||
+                     resample_polyphase_range(mono, i0, num_samples, sample_rate, quality, output + (n0 - out0), n0, n1) != 0;
+        }
+        free(mono);
+    } else if (info->flac) {
+        // no filter bank for this ratio (over RESAMPLE_MAX_PHASES phases)
+        failed = 1;
+    } else {
+        // Linear interpolation, reading the two neighbouring frames directly
+        // from the source buffer instead of a pre-mixed mono copy.
+        for (int64_t i = 0; i < output_count; i++) {
+            // exact integer position; a float index drifts on long files
+            int64_t pos = (out0 + i) * sample_rate;
+            int64_t idx0 = pos / 16000;
+            float frac = (float)(pos % 16000) / 16000.0f;
+            if (idx0 + 1 < num_samples) {
+                float ab[2];
+                wav_convert(info, convert, channel, src + idx0 * frame_bytes, 2, ab);
+                output[i] = ab[0] * (1.0f - frac) + ab[1] * frac;
+            } else if (idx0 < num_samples) {
+                wav_convert(info, convert, channel, src + idx0 * frame_bytes, 1, &output[i]);
+            } else {
+                output[i] = 0.0f;
+            }
+        }
+    }
+
+    wav_samples_t* result = failed ? NULL : (wav_samples_t*)malloc(sizeof(wav_samples_t));
+    if (!result) {
+        free(output);
+        return NULL;
+    }
+    result->data = output;
+    result->count = (int)output_count;
+    result->origin = (int)out0;
+    return result;
+}
+
+// Decode a parsed WAV into a freshly allocated 16kHz mono buffer.
+static wav_samples_t* wav_decode(const wav_info_t* info, int quality) {
+    return wav_decode_window(info, quality, 0, 0, -1);
+}
+
+// Decode [offset_ms, offset_ms + duration_ms) of an audio file (0 / 0 = the
+// whole file). Thread-safe: batch workers call it concurrently.
+static wav_samples_t* load_audio_file(const char* path, int quality, int64_t offset_ms, int64_t duration_ms) {
+    mapped_file_t m = {0};
+    if (map_file(path, &m) != 0) return NULL;
+
+    wav_info_t info;
+    flac_stream_t flac;
+    wav_samples_t* result = NULL;
+    if (audio_parse(m.base, m.size, &info, &flac) == 0) {
+        result = wav_decode_window(&info, quality, offset_ms, duration_ms, -1);
+    }
+    unmap_file(&m);
+    return result;
+}
+
+wav_samples_t* whisper_load_wav(moonbit_bytes_t wav_path, int32_t quality) {
+    char* path = bytes_to_cstring(wav_path);
+    wav_samples_t* result = load_audio_file(path, quality, 0, 0);
+    free(path);
+    return result;
+}
+
+// Decode a WAV or FLAC image held in a MoonBit Bytes buffer (no filesystem
+// access).
+wav_samples_t* whisper_load_wav_bytes(moonbit_bytes_t data, int32_t quality) {
+    wav_info_t info;
+    flac_stream_t flac;
+    if (audio_parse(data, (size_t)Moonbit_array_length(data), &info, &flac) != 0) return NULL;
+    return wav_decode(&info, quality);
+}
+
+// Decode only [offset_ms, offset_ms + duration_ms) of a WAV file; see
+// wav_decode_window. whisper_samples_origin gives the window's start.
+wav_samples_t* whisper_load_wav_range(moonbit_bytes_t wav_path, int32_t quality, int32_t offset_ms, int32_t duration_ms) {
+    char* path = bytes_to_cstring(wav_path);
+    wav_samples_t* result = load_audio_file(path, quality, offset_ms, duration_ms);
+    free(path);
+    return result;
+}
+
+int32_t whisper_samples_count(wav_samples_t* s) {
+    return s ? s->count : 0;
+}
+
+int32_t whisper_samples_origin(wav_samples_t* s) {
+    return s ? s->origin : 0;
+}
+
+int32_t whisper_samples_is_null(wav_samples_t* s) {
+    return s == NULL ? 1 : 0;
+}
+
+void whisper_samples_free(wav_samples_t* s) {
+    if (s) {
+        if (s->data) free(s->data);
+        free(s);
+    }
+}
+
+// One 16kHz buffer per source channel, for channel-separated recordings.
+typedef struct {
+    int n;
+    wav_samples_t** ch;
+} wav_channel_set_t;
+
+void whisper_channel_set_free(wav_channel_set_t* set) {
+    if (!set) return;
+    for (int c = 0; c < set->n; c++) whisper_samples_free(set->ch[c]);
+    free(set->ch);
+    free(set);
+}
+
+// Decode [offset_ms, offset_ms + duration_ms) of every channel separately
+// (duration_ms = 0: to the end).
+wav_channel_set_t* whisper_load_wav_channels(moonbit_bytes_t wav_path, int32_t quality, int32_t offset_ms, int32_t duration_ms) {
+    char* path = bytes_to_cstring(wav_path);
+    mapped_file_t m = {0};
+    int rc = map_file(path, &m);
+    free(path);
+    if (rc != 0) return NULL;
+
+    wav_info_t info;
+    flac_stream_t flac;
+    wav_channel_set_t* set = NULL;
+    if (audio_parse(m.base, m.size, &info, &flac) == 0 && info.num_channels >= 1) {
+        set = (wav_channel_set_t*)calloc(1, sizeof(wav_channel_set_t));
+        if (set) set->ch = (wav_samples_t**)calloc((size_t)info.num_channels, sizeof(wav_samples_t*));
+        if (set && set->ch) {
+            set->n = info.num_channels;
+            for (int c = 0; c < set->n; c++) {
+                set->ch[c] = wav_decode_window(&info, quality, offset_ms, duration_ms, c);
+                if (!set->ch[c]) {
+                    whisper_channel_set_free(set);
+                    set = NULL;
+                    break;
+                }
+            }
+        } else if (set) {
+            free(set);
+            set = NULL;
+        }
+    }
+    unmap_file(&m);
+    return set;
+}
+
+int32_t whisper_channel_set_is_null(wav_channel_set_t* set) {
+    return set == NULL ? 1 : 0;
+}
+
+int32_t whisper_channel_set_count(wav_channel_set_t* set) {
+    return set ? set->n : 0;
+}
+
+// Move channel c out of the set; the caller frees it with whisper_samples_free.
+wav_samples_t* whisper_channel_set_take(wav_channel_set_t* set, int32_t c) {
+    if (!set || c < 0 || c >= set->n) return NULL;
+    wav_samples_t* s = set->ch[c];
+    set->ch[c] = NULL;
+    return s;
+}
+
+// Benchmark: decode a synthetic 60s mono int16 WAV at `in_rate` through the
+// loader with the given resampler quality. Fills out[0] with throughput in
+// million output samples per second and out[1] with the SNR (dB) against the
+// ideal band-limited 16kHz signal. The test signal has in-band tones plus,
+// for rates above 17kHz, a loud tone above 8kHz that should be rejected.
+void whisper_bench_resample(int32_t in_rate, int32_t quality, double* out) {
+    int out_len = Moonbit_array_length(out);
+    if (out_len < 2 || in_rate <= 0) return;
+    out[0] = 0.0;
+    out[1] = 0.0;
+    const double tones[3] = { 440.0, 1000.0, 3000.0 };
+    const double alias_tone = 0.45 * in_rate;
+    const int with_alias = alias_tone > 8500.0;
+    const int64_t n_in = (int64_t)in_rate * 60;
+    int16_t* pcm = (int16_t*)malloc((size_t)n_in * sizeof(int16_t));
+    if (!pcm) return;
+    for (int64_t i = 0; i < n_in; i++) {
+        double t = (double)i / in_rate;
+        double v = 0.0;
+        for (int k = 0; k < 3; k++) v += 0.2 * sin(2.0 * M_PI * tones[k] * t);
+        if (with_alias) v += 0.3 * sin(2.0 * M_PI * alias_tone * t);
+        pcm[i] = (int16_t)lrint(v * 32767.0);
+    }
+    wav_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.audio_format = WAVE_FORMAT_PCM;
+    info.num_channels = 1;
+    info.sample_rate = in_rate;
+    info.bits_per_sample = 16;
+    info.sample_format = SAMPLE_S16;
+    info.frame_bytes = 2;
+    info.data = (const uint8_t*)pcm;
+    info.data_size = (size_t)n_in * sizeof(int16_t);
+
+    const int iters = 3;
+    wav_samples_t* s = NULL;
+    double t0 = now_ms();
+    for (int it = 0; it < iters; it++) {
+        if (s) whisper_samples_free(s);
+        s = wav_decode(&info, quality);
+    }
+    double elapsed = now_ms() - t0;
+    free(pcm);
+    if (!s) return;
+
+    double sig = 0.0, err = 0.0;
+    int margin = 16000;  // skip edge transients
+    for (int i = margin; i < s->count - margin; i++) {
+        double t = (double)i / 16000.0;
+        double ideal = 0.0;
+        for (int k = 0; k < 3; k++) ideal += 0.2 * sin(2.0 * M_PI * tones[k] * t);
+        double d = s->data[i] - ideal;
+        sig += ideal * ideal;
+        err += d * d;
+    }
+    out[0] = elapsed > 0.0 ? (double)s->count * iters / (elapsed * 1000.0) : 0.0;
+    out[1] = err > 0.0 ? 10.0 * log10(sig / err) : 0.0;
+    whisper_samples_free(s);
+}
+
+// --- Streaming WAV reader (bounded memory) ---
+//
+// Reads the data chunk piecewise and yields 16kHz mono blocks on demand.
+// Each piece is downmixed as it is read; resampling convolves over a carried
+// window of the last `taps` mono input samples, so memory stays O(block)
+// regardless of file length. Output is identical to the whole-file path.
+// FLAC files are mapped and decoded one frame at a time as pieces are read.
+
+typedef struct {
+    FILE* f;
+    wav_info_t info;
+    size_t frame_bytes;
+    int64_t frames_left;   // -1 when unknown (read until EOF)
+    int64_t frames_read;
+    int block_size;
+    const resample_filter_t* filter;  // NULL for 16kHz passthrough
+    uint8_t* raw;
+    size_t chunk_frames;
+    float* hist;           // mono input window
+    size_t hist_len;
+    int64_t hist_start;    // absolute input index of hist[0]
+    int64_t in_pos;        // integer input position of the next output
+    int phase;             // its polyphase phase
+    int64_t out_pos;
+    int64_t out_total;     // -1 until known
+    int eof;
+    // FLAC: the mapped file and the frame being read out
+    mapped_file_t map;
+    flac_stream_t flac;
+    size_t flac_pos;       // offset of the next frame
+    int32_t* flac_scratch;
+    float* flac_frame;     // interleaved
+    int flac_len;
+    int flac_used;
+} wav_stream_t;
+
+// Read RIFF chunk headers up to the start of the data chunk.
+static int wav_stream_read_header(FILE* f, wav_info_t* info, int64_t* data_size) {
+    uint8_t hdr[12];
+    memset(info, 0, sizeof(*info));
+    if (fread(hdr, 1, 12, f) != 12 || (memcmp(hdr, "RIFF", 4) != 0 && !wav_is_rf64(hdr)) ||
+        memcmp(hdr + 8, "WAVE", 4) != 0) {
+        return -1;
+    }
+    const int rf64 = wav_is_rf64(hdr);
+    uint64_t ds64_data_size = 0;
+    int have_fmt = 0;
+    while (1) {
+        uint8_t chunk[8];
+        if (fread(chunk, 1, 8, f) != 8) return -1;
+        uint32_t chunk_size = rd_u32(chunk + 4);
+        if (memcmp(chunk, "ds64", 4) == 0) {
+            uint8_t body[24];
+            if (chunk_size < 24 || fread(body, 1, 24, f) != 24) return -1;
+            ds64_data_size = rd_u64(body + 8);
+            if (fseek(f, (long)(chunk_size - 24) + (chunk_size & 1), SEEK_CUR) != 0) return -1;
+        } else if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (chunk_size < 16 || chunk_size > 4096) return -1;
+            uint8_t body[4096];
+            if (fread(body, 1, chunk_size, f) != chunk_size) return -1;
+            if (wav_parse_fmt(body, chunk_size, info) != 0) return -1;
+            if (chunk_size & 1) fseek(f, 1, SEEK_CUR);
+            have_fmt = 1;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_fmt) return -1;
+            *data_size = rf64 && chunk_size == 0xFFFFFFFFu ? (int64_t)ds64_data_size : (int64_t)chunk_size;
+            return 0;
+        } else {
+            if (fseek(f, (long)chunk_size + (chunk_size & 1), SEEK_CUR) != 0) return -1;
+        }
+    }
+}
+
+static void wav_stream_free(wav_stream_t* s) {
+    if (!s) return;
+    if (s->f) fclose(s->f);
+    unmap_file(&s->map);
+    free(s->raw);
+    free(s->hist);
+    free(s->flac_scratch);
+    free(s->flac_frame);
+    free(s);
+}
+
+// Allocate the conversion buffers once the format is known. Takes ownership
+// of f (NULL for FLAC, which the caller attaches afterwards).
+static wav_stream_t* wav_stream_create(FILE* f, const wav_info_t* info, int64_t data_size, int quality, int block_size) {
+    if (!pcm_kernel(info) || info->num_channels < 1 || info->sample_rate <= 0 || block_size < 1) {
+        if (f) fclose(f);
+        return NULL;
+    }
+    wav_stream_t* s = (wav_stream_t*)calloc(1, sizeof(wav_stream_t));
+    if (!s) {
+        if (f) fclose(f);
+        return NULL;
+    }
+    s->f = f;
+    s->info = *info;
+    s->frame_bytes = info->frame_bytes;
+    s->frames_left = data_size >= 0 ? data_size / (int64_t)s->frame_bytes : -1;
+    s->block_size = block_size;
+    s->out_total = -1;
+    if (info->sample_rate != 16000) {
+        s->filter = resample_filter_get(info->sample_rate, quality);
+        if (!s->filter) {
+            wav_stream_free(s);
+            return NULL;
+        }
+    }
+
+    // one piece of input covers roughly one output block
+    int64_t per_block = s->filter ? (int64_t)block_size * s->filter->M / s->filter->L + 1 : block_size;
+    s->chunk_frames = (size_t)(per_block < 4096 ? 4096 : per_block);
+    s->raw = (uint8_t*)malloc(s->chunk_frames * s->frame_bytes);
+    if (!s->raw) {
+        wav_stream_free(s);
+        return NULL;
+    }
+    if (s->filter) {
+        int K = s->filter->taps;
+        // carried window + one piece + zero padding at either end
+        s->hist = (float*)calloc((size_t)2 * K + s->chunk_frames, sizeof(float));
+        if (!s->hist) {
+            wav_stream_free(s);
+            return NULL;
+        }
+        s->hist_len = (size_t)(K / 2 - 1);
+        s->hist_start = -(int64_t)(K / 2 - 1);
+    }
+    return s;
+}
+
+// Decode up to n frames of a FLAC stream into dst, a frame at a time.
+// Returns fewer at the end of the frames.
+static size_t wav_stream_read_flac(wav_stream_t* s, float* dst, size_t n) {
+    const flac_stream_t* fs = &s->flac;
+    const int ch = fs->si.channels;
+    size_t got = 0;
+    while (got < n) {
+        if (s->flac_used == s->flac_len) {
+            flac_frame_header_t h;
+            if (s->flac_pos >= fs->size ||
+                flac_parse_frame_header(fs->buf + s->flac_pos, fs->size - s->flac_pos, &fs->si, &h) != 0) {
+                break;
+            }
+            size_t end = flac_frame_end(fs->buf, fs->size, s->flac_pos, &fs->si, h.header_len);
+            if (flac_decode_frame(fs->buf + s->flac_pos, end - s->flac_pos, &fs->si, s->flac_scratch, s->flac_frame) != 0) {
+                // a damaged frame decodes as silence
+                memset(s->flac_frame, 0, (size_t)h.block_size * ch * sizeof(float));
+            }
+            s->flac_pos = end;
+            s->flac_len = h.block_size;
+            s->flac_used = 0;
+        }
+        size_t k = (size_t)(s->flac_len - s->flac_used);
+        if (k > n - got) k = n - got;
+        memcpy(dst + got * ch, s->flac_frame + (size_t)s->flac_used * ch, k * ch * sizeof(float));
+        s->flac_used += (int)k;
+        got += k;
+    }
+    return got;
+}
+
+// Read up to `max_frames` raw frames into s->raw. Sets eof on a short read.
+static size_t wav_stream_read_raw(wav_stream_t* s, size_t max_frames) {
+    size_t want = max_frames < s->chunk_frames ? max_frames : s->chunk_frames;
+    if (s->frames_left >= 0 && (int64_t)want > s->frames_left) want = (size_t)s->frames_left;
+    size_t got = 0;
+    if (want > 0) {
+        got = s->info.flac ? wav_stream_read_flac(s, (float*)s->raw, want) : fread(s->raw, s->frame_bytes, want, s->f);
+    }
+    if (got < want || want == 0) s->eof = 1;
+    if (s->frames_left >= 0) {
+        s->frames_left -= (int64_t)got;
+        if (s->frames_left == 0) s->eof = 1;
+    }
+    s->frames_read += (int64_t)got;
+    return got;
+}
+
+// Drop history the next output no longer needs, then append one piece.
+static void wav_stream_fill(wav_stream_t* s) {
+    const int K = s->filter->taps;
+    int64_t keep_from = s->in_pos - K / 2 + 1;
+    if (keep_from > s->hist_start) {
+        size_t drop = (size_t)(keep_from - s->hist_start);
+        if (drop > s->hist_len) drop = s->hist_len;
+        memmove(s->hist, s->hist + drop, (s->hist_len - drop) * sizeof(float));
+        s->hist_len -= drop;
+        s->hist_start += (int64_t)drop;
+    }
+    size_t got = wav_stream_read_raw(s, s->chunk_frames);
+    pcm_kernel(&s->info)(s->raw, s->info.num_channels, got, s->hist + s->hist_len);
+    s->hist_len += got;
+    if (s->eof) {
+        memset(s->hist + s->hist_len, 0, (size_t)(K / 2) * sizeof(float));
+        s->hist_len += (size_t)(K / 2);
+        s->out_total = resample_out_count(s->frames_read, s->info.sample_rate);
+    }
+}
+
+// Map a FLAC file and set up frame-at-a-time decoding.
+static wav_stream_t* wav_stream_open_flac(const char* path, int quality, int block_size) {
+    mapped_file_t m = {0};
+    if (map_file(path, &m) != 0) return NULL;
+    wav_info_t info;
+    flac_stream_t flac;
+    if (audio_parse(m.base, m.size, &info, &flac) != 0 || !info.flac) {
+        unmap_file(&m);
+        return NULL;
+    }
+    wav_stream_t* s = wav_stream_create(NULL, &info, (int64_t)info.data_size, quality, block_size);
+    if (!s) {
+        unmap_file(&m);
+        return NULL;
+    }
+    s->map = m;
+    s->flac = flac;
+    s->info.flac = &s->flac;
+    s->flac_pos = flac.first_frame;
+    const size_t frame_len = (size_t)flac.si.channels * flac.si.max_block;
+    s->flac_scratch = (int32_t*)malloc(frame_len * sizeof(int32_t));
+    s->flac_frame = (float*)malloc(frame_len * sizeof(float));
+    if (!s->flac_scratch || !s->flac_frame) {
+        wav_stream_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+// Open a WAV or FLAC file for streaming.
+wav_stream_t* whisper_wav_stream_open(moonbit_bytes_t wav_path, int32_t quality, int32_t block_size) {
+    char* path = bytes_to_cstring(wav_path);
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        free(path);
+        return NULL;
+    }
+    uint8_t magic[4];
+    size_t magic_len = fread(magic, 1, sizeof(magic), f);
+    if (flac_is_stream(magic, magic_len)) {
+        fclose(f);
+        wav_stream_t* s = wav_stream_open_flac(path, quality, block_size);
+        free(path);
+        return s;
+    }
+    free(path);
+    rewind(f);
+    wav_info_t info;
+    int64_t data_size = 0;
+    if (wav_stream_read_header(f, &info, &data_size) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    return wav_stream_create(f, &info, data_size, quality, block_size);
+}
+
+// Headerless interleaved little-endian PCM of a declared format read from
+// an fd (stdin, FIFO or socket) until EOF. sample_format is one of the
+// SAMPLE_* codes. The fd is dup'd, so the caller keeps its descriptor.
+wav_stream_t* whisper_wav_stream_open_fd(int32_t fd, int32_t sample_format, int32_t num_channels, int32_t sample_rate, int32_t quality, int32_t block_size) {
+    static const int container_bytes[] = { 0, 1, 2, 3, 4, 4 };
+    if (sample_format <= SAMPLE_UNSUPPORTED || sample_format > SAMPLE_F32) return NULL;
+    if (num_channels < 1 || sample_rate <= 0) return NULL;
+    wav_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.audio_format = sample_format == SAMPLE_F32 ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+    info.num_channels = num_channels;
+    info.sample_rate = sample_rate;
+    info.bits_per_sample = container_bytes[sample_format] * 8;
+    info.sample_format = sample_format;
+    info.frame_bytes = (size_t)container_bytes[sample_format] * num_channels;
+
+    int own_fd = dup(fd);
+    if (own_fd < 0) return NULL;
+    FILE* f = fdopen(own_fd, "rb");
+    if (!f) {
+        close(own_fd);
+        return NULL;
+    }
+    return wav_stream_create(f, &info, -1, quality, block_size);
+}
+
+int32_t whisper_wav_stream_is_null(wav_stream_t* s) {
+    return s == NULL ? 1 : 0;
+}
+
+// Fill `out` (a MoonBit FixedArray[Float]) with up to block_size samples.
+// Returns the number written; 0 at end of stream.
+int32_t whisper_wav_stream_read(wav_stream_t* s, float* out) {
+    if (!s) return -1;
+    int32_t n = Moonbit_array_length(out);
+    if (n > s->block_size) n = s->block_size;
+    int32_t produced = 0;
+    const int ch = s->info.num_channels;
+
+    if (!s->filter) {
+        pcm_kernel_t k = pcm_kernel(&s->info);
+        while (produced < n && !s->eof) {
+            size_t got = wav_stream_read_raw(s, (size_t)(n - produced));
+            k(s->raw, ch, got, out + produced);
+            produced += (int32_t)got;
+        }
+        s->out_pos += produced;
+        return produced;
+    }
+
+    const int L = s->filter->L, M = s->filter->M, K = s->filter->taps;
+    const dot_kernel_t dot = dot_kernel();
+    while (produced < n) {
+        if (s->out_total >= 0 && s->out_pos >= s->out_total) break;
+        if (s->in_pos + K / 2 >= s->hist_start + (int64_t)s->hist_len) {
+            if (s->eof) break;
+            wav_stream_fill(s);
+            continue;
+        }
+        const float* x = s->hist + (s->in_pos - K / 2 + 1 - s->hist_start);
+        out[produced++] = dot(x, s->filter->bank + (size_t)s->phase * K, K);
+        s->out_pos++;
+        s->in_pos += M / L;
+        s->phase += M % L;
+        if (s->phase >= L) {
+            s->phase -= L;
+            s->in_pos++;
+        }
+    }
+    return produced;
+}
+
+// Total 16kHz samples the stream will yield, or -1 if not known yet.
+int64_t whisper_wav_stream_total(wav_stream_t* s) {
+    if (!s) return -1;
+    if (s->out_total >= 0) return s->out_total;
+    if (s->frames_left < 0) return -1;
+    return resample_out_count(s->frames_read + s->frames_left, s->info.sample_rate);
+}
+
+void whisper_wav_stream_free(wav_stream_t* s) {
+    wav_stream_free(s);
+}
+
+// --- Inference ---
+//
+// The *_range variants run on samples[offset, offset + count), which is how
+// AudioBuffer views share one decoded buffer without copying.
+
+static int samples_range_ok(const wav_samples_t* samples, int32_t offset, int32_t count) {
+    return samples && samples->data && offset >= 0 && count >= 0 && offset <= samples->count &&
+           count <= samples->count - offset;
+}
+
+int32_t whisper_run_full_range(struct whisper_context* ctx, struct whisper_full_params* params, wav_samples_t* samples, int32_t offset, int32_t count) {
+    if (!ctx || !params || !samples_range_ok(samples, offset, count)) return -1;
+    return whisper_full(ctx, *params, samples->data + offset, count);
+}
+
+int32_t whisper_run_full(struct whisper_context* ctx, struct whisper_full_params* params, wav_samples_t* samples) {
+    return whisper_run_full_range(ctx, params, samples, 0, samples ? samples->count : 0);
+}
+
+// Run directly on a borrowed MoonBit FixedArray[Float] of 16kHz mono PCM.
+int32_t whisper_run_full_pcm(struct whisper_context* ctx, struct whisper_full_params* params, float* pcm) {
+    if (!ctx || !params || !pcm) return -1;
+    return whisper_full(ctx, *params, pcm, Moonbit_array_length(pcm));
+}
+
+int32_t whisper_run_full_pcm_range(struct whisper_context* ctx, struct whisper_full_params* params, float* pcm, int32_t offset, int32_t count) {
+    if (!ctx || !params || !pcm) return -1;
+    int32_t n = Moonbit_array_length(pcm);
+    if (offset < 0 || count < 0 || offset > n || count > n - offset) return -1;
+    return whisper_full(ctx, *params, pcm + offset, count);
+}
+
+int32_t whisper_run_full_parallel_range(struct whisper_context* ctx, struct whisper_full_params* params, wav_samples_t* samples, int32_t offset, int32_t count, int32_t n_processors) {
+    if (!ctx || !params || !samples_range_ok(samples, offset, count)) return -1;
+    if (n_processors < 1) n_processors = 1;
+    return whisper_full_parallel(ctx, *params, samples->data + offset, count, n_processors);
+}
+
+int32_t whisper_run_full_parallel(struct whisper_context* ctx, struct whisper_full_params* params, wav_samples_t* samples, int32_t n_processors) {
+    return whisper_run_full_parallel_range(ctx, params, samples, 0, samples ? samples->count : 0, n_processors);
+}
+
+// --- Concurrent jobs on per-worker whisper states ---
+//
+// Each worker owns one whisper_state and all share the context's model
+// weights, so several inputs are decoded at once without loading the model
+// again. A worker's state is reused for the next job, so segments are copied
+// out as each job finishes. File jobs are decoded by the worker that runs
+// them and their samples freed right after, so a batch of any length holds
+// at most n_workers decoded files at a time. In pipelined runs a dedicated
+// loader thread decodes them instead, in order and at most `depth` jobs
+// ahead of the workers, so decoding overlaps inference.
+
+typedef struct {
+    char* text;
+    int64_t t0;
+    int64_t t1;
+    float no_speech_prob;
+    int speaker_turn_next;
+} job_segment_t;
+
+// Stage statistics of the last run, in ms (see whisper_jobs_stat).
+enum {
+    JOBS_STAT_WALL,
+    JOBS_STAT_LOAD_BUSY,   // loader decoding / prefetching
+    JOBS_STAT_LOAD_WAIT,   // loader blocked on a full queue
+    JOBS_STAT_INFER_BUSY,  // summed over workers
+    JOBS_STAT_INFER_WAIT,  // workers blocked on an empty queue, summed
+    JOBS_STAT_COUNT
+};
+
+typedef struct {
+    const float* data;
+    int n_samples;
+    // file jobs (data == NULL)
+    char* path;
+    int quality;
+    int offset_ms;
+    int duration_ms;
+    int origin;  // 16kHz index of the decoded window's start
+    int load_failed;
+    wav_samples_t* loaded;  // decoded by the pipeline loader, not yet run
+    int rc;
+    int lang_id;
+    job_segment_t* segs;
+    int n_segs;
+} whisper_job_t;
+
+typedef struct {
+    struct whisper_context* ctx;
+    int n_workers;
+    struct whisper_state** states;
+    whisper_job_t* jobs;
+    int n_jobs;
+    int cap;
+    int n_threads;  // per-job override of params.n_threads when > 0
+    // run-time
+    struct whisper_full_params params;
+    int next_job;
+    pthread_mutex_t lock;
+    // pipelined runs: jobs [0, n_loaded) are ready; the loader waits on
+    // `space` while `depth` of them are queued and not yet taken
+    int depth;
+    int n_loaded;
+    int loader_done;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    double stats[JOBS_STAT_COUNT];
+} whisper_jobs_t;
+
+typedef struct {
+    whisper_jobs_t* jobs;
+    struct whisper_state* state;
+    double busy_ms;
+    double wait_ms;
+} job_worker_t;
+
+static void job_clear(whisper_job_t* job) {
+    for (int i = 0; i < job->n_segs; i++) free(job->segs[i].text);
+    free(job->segs);
+    job->segs = NULL;
+    job->n_segs = 0;
+}
+
+static void job_collect(whisper_job_t* job, struct whisper_state* state) {
+    int n = whisper_full_n_segments_from_state(state);
+    job->lang_id = whisper_full_lang_id_from_state(state);
+    job->segs = n > 0 ? (job_segment_t*)calloc((size_t)n, sizeof(job_segment_t)) : NULL;
+    if (!job->segs) return;
+    for (int i = 0; i < n; i++) {
+        const char* text = whisper_full_get_segment_text_from_state(state, i);
+        job->segs[i].text = strdup(text ? text : "");
+        job->segs[i].t0 = whisper_full_get_segment_t0_from_state(state, i);
+        job->segs[i].t1 = whisper_full_get_segment_t1_from_state(state, i);
+        job->segs[i].no_speech_prob = whisper_full_get_segment_no_speech_prob_from_state(state, i);
+        job->segs[i].speaker_turn_next = whisper_full_get_segment_speaker_turn_next_from_state(state, i);
     }
-    int len = (int)strlen(str);
-    moonbit_bytes_t result = moonbit_make_bytes(len, 0);
-    memcpy(result, str, len);
-    return result;
+    job->n_segs = n;
 }
 
-// --- Context management ---
+static wav_samples_t* job_load(whisper_job_t* job) {
+    wav_samples_t* samples = load_audio_file(job->path, job->quality, job->offset_ms, job->duration_ms);
+    job->load_failed = samples == NULL;
+    if (samples) job->origin = samples->origin;
+    return samples;
+}
 
-struct whisper_context* whisper_ctx_init(moonbit_bytes_t model_path) {
-    char* path = bytes_to_cstring(model_path);
-    struct whisper_context_params cparams = whisper_context_default_params();
-    struct whisper_context* ctx = whisper_init_from_file_with_params(path, cparams);
-    free(path);
-    return ctx;
+// Transcribe and free the decoded samples of a file job.
+static void job_run_samples(whisper_jobs_t* jobs, struct whisper_state* state, whisper_job_t* job, wav_samples_t* samples) {
+    job->rc = -1;
+    if (!samples) return;
+    job->rc = whisper_full_with_state(jobs->ctx, state, jobs->params, samples->data, samples->count);
+    if (job->rc == 0) job_collect(job, state);
+    whisper_samples_free(samples);
 }
 
-int32_t whisper_ctx_is_null(struct whisper_context* ctx) {
-    return ctx == NULL ? 1 : 0;
+static void job_run_data(whisper_jobs_t* jobs, struct whisper_state* state, whisper_job_t* job) {
+    job->rc = whisper_full_with_state(jobs->ctx, state, jobs->params, job->data, job->n_samples);
+    if (job->rc == 0) job_collect(job, state);
 }
 
-void whisper_ctx_free(struct whisper_context* ctx) {
-    if (ctx != NULL) {
-        whisper_free(ctx);
+static void job_run_file(whisper_jobs_t* jobs, struct whisper_state* state, whisper_job_t* job) {
+    job_run_samples(jobs, state, job, job_load(job));
+}
+
+static void* job_worker_main(void* arg) {
+    job_worker_t* w = (job_worker_t*)arg;
+    whisper_jobs_t* jobs = w->jobs;
+    while (1) {
+        pthread_mutex_lock(&jobs->lock);
+        int j = jobs->next_job < jobs->n_jobs ? jobs->next_job++ : -1;
+        pthread_mutex_unlock(&jobs->lock);
+        if (j < 0) break;
+        double t0 = now_ms();
+        whisper_job_t* job = &jobs->jobs[j];
+        if (job->path) {
+            job_run_file(jobs, w->state, job);
+        } else {
+            job_run_data(jobs, w->state, job);
+        }
+        w->busy_ms += now_ms() - t0;
     }
+    return NULL;
 }
 
-// --- Params management (heap-allocated) ---
+void whisper_jobs_free(whisper_jobs_t* jobs) {
+    if (!jobs) return;
+    for (int j = 0; j < jobs->n_jobs; j++) {
+        job_clear(&jobs->jobs[j]);
+        free(jobs->jobs[j].path);
+    }
+    free(jobs->jobs);
+    for (int w = 0; w < jobs->n_workers; w++) {
+        if (jobs->states[w]) whisper_free_state(jobs->states[w]);
+    }
+    free(jobs->states);
+    pthread_mutex_destroy(&jobs->lock);
+    pthread_cond_destroy(&jobs->ready);
+    pthread_cond_destroy(&jobs->space);
+    free(jobs);
+}
 
-struct whisper_full_params* whisper_params_create(void) {
-    struct whisper_full_params* p = (struct whisper_full_params*)malloc(sizeof(struct whisper_full_params));
-    *p = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-    // Disable noisy output by default
-    p->print_progress = false;
-    p->print_realtime = false;
-    p->print_special = false;
-    p->print_timestamps = false;
-    return p;
+// A job set run by n_workers threads, each with its own state on ctx.
+whisper_jobs_t* whisper_jobs_create(struct whisper_context* ctx, int32_t n_workers) {
+    if (!ctx || n_workers < 1) return NULL;
+    whisper_jobs_t* jobs = (whisper_jobs_t*)calloc(1, sizeof(whisper_jobs_t));
+    if (!jobs) return NULL;
+    jobs->ctx = ctx;
+    pthread_mutex_init(&jobs->lock, NULL);
+    pthread_cond_init(&jobs->ready, NULL);
+    pthread_cond_init(&jobs->space, NULL);
+    jobs->states = (struct whisper_state**)calloc((size_t)n_workers, sizeof(struct whisper_state*));
+    if (!jobs->states) {
+        whisper_jobs_free(jobs);
+        return NULL;
+    }
+    jobs->n_workers = n_workers;
+    for (int w = 0; w < n_workers; w++) {
+        jobs->states[w] = whisper_init_state(ctx);
+        if (!jobs->states[w]) {
+            whisper_jobs_free(jobs);
+            return NULL;
+        }
+    }
+    return jobs;
 }
 
-void whisper_params_set_language(struct whisper_full_params* p, moonbit_bytes_t lang) {
-    // whisper expects a static string or one that outlives the call.
-    // We use a static buffer since language is set once before whisper_full.
-    static char lang_buffer[32];
-    char* tmp = bytes_to_cstring(lang);
-    strncpy(lang_buffer, tmp, sizeof(lang_buffer) - 1);
-    lang_buffer[sizeof(lang_buffer) - 1] = '\0';
-    free(tmp);
-    p->language = lang_buffer;
+int32_t whisper_jobs_is_null(whisper_jobs_t* jobs) {
+    return jobs == NULL ? 1 : 0;
 }
 
-void whisper_params_set_translate(struct whisper_full_params* p, int32_t translate) {
-    p->translate = translate != 0;
+// Queue samples[offset, offset + count). The samples must stay alive until
+// whisper_jobs_run returns. Returns the job index, or -1.
+static whisper_job_t* jobs_push(whisper_jobs_t* jobs) {
+    if (jobs->n_jobs == jobs->cap) {
+        int cap = jobs->cap ? jobs->cap * 2 : 8;
+        whisper_job_t* grown = (whisper_job_t*)realloc(jobs->jobs, (size_t)cap * sizeof(whisper_job_t));
+        if (!grown) return NULL;
+        jobs->jobs = grown;
+        jobs->cap = cap;
+    }
+    whisper_job_t* job = &jobs->jobs[jobs->n_jobs];
+    memset(job, 0, sizeof(*job));
+    job->rc = -1;
+    job->lang_id = -1;
+    return job;
 }
 
-void whisper_params_set_n_threads(struct whisper_full_params* p, int32_t n_threads) {
-    p->n_threads = n_threads;
+int32_t whisper_jobs_add(whisper_jobs_t* jobs, wav_samples_t* samples, int32_t offset, int32_t count) {
+    if (!jobs || !samples_range_ok(samples, offset, count)) return -1;
+    whisper_job_t* job = jobs_push(jobs);
+    if (!job) return -1;
+    job->data = samples->data + offset;
+    job->n_samples = count;
+    return jobs->n_jobs++;
 }
 
-void whisper_params_free(struct whisper_full_params* p) {
-    if (p != NULL) {
-        free(p);
+// Queue the [offset_ms, offset_ms + duration_ms) window of an audio file
+// (0 / 0 = all of it), decoded by the worker that picks the job up. Returns
+// the job index, or -1.
+int32_t whisper_jobs_add_file(whisper_jobs_t* jobs, moonbit_bytes_t path, int32_t quality, int32_t offset_ms, int32_t duration_ms) {
+    if (!jobs) return -1;
+    whisper_job_t* job = jobs_push(jobs);
+    if (!job) return -1;
+    job->path = bytes_to_cstring(path);
+    job->quality = quality;
+    job->offset_ms = offset_ms;
+    job->duration_ms = duration_ms;
+    return jobs->n_jobs++;
+}
+
+// Threads each job's whisper_full uses, overriding the params' n_threads
+// (0 = keep it).
+void whisper_jobs_set_n_threads(whisper_jobs_t* jobs, int32_t n_threads) {
+    if (jobs) jobs->n_threads = n_threads > 0 ? n_threads : 0;
+}
+
+// Run `worker_main` on min(n_workers, n_jobs) workers, the caller's thread
+// being worker 0, and wait for them. Fills the wall and inference stats.
+static int jobs_run_workers(whisper_jobs_t* jobs, void* (*worker_main)(void*)) {
+    int n_threads = jobs->n_workers < jobs->n_jobs ? jobs->n_workers : jobs->n_jobs;
+    pthread_t* threads = (pthread_t*)calloc((size_t)(n_threads > 0 ? n_threads : 1), sizeof(pthread_t));
+    job_worker_t* workers = (job_worker_t*)calloc((size_t)(n_threads > 0 ? n_threads : 1), sizeof(job_worker_t));
+    int* started = (int*)calloc((size_t)(n_threads > 0 ? n_threads : 1), sizeof(int));
+    if (!threads || !workers || !started) {
+        free(threads);
+        free(workers);
+        free(started);
+        return -1;
+    }
+    double t0 = now_ms();
+    for (int w = 0; w < n_threads; w++) {
+        workers[w] = (job_worker_t){ jobs, jobs->states[w], 0.0, 0.0 };
+        if (w > 0 && pthread_create(&threads[w], NULL, worker_main, &workers[w]) == 0) {
+            started[w] = 1;
+        }
     }
+    // workers that failed to start leave their share of the queue to the
+    // others
+    if (n_threads > 0) worker_main(&workers[0]);
+    for (int w = 1; w < n_threads; w++) {
+        if (started[w]) pthread_join(threads[w], NULL);
+    }
+    jobs->stats[JOBS_STAT_WALL] = now_ms() - t0;
+    for (int w = 0; w < n_threads; w++) {
+        jobs->stats[JOBS_STAT_INFER_BUSY] += workers[w].busy_ms;
+        jobs->stats[JOBS_STAT_INFER_WAIT] += workers[w].wait_ms;
+    }
+    free(threads);
+    free(workers);
+    free(started);
+    return 0;
 }
 
-// --- WAV loading (16-bit PCM mono -> float32 at 16kHz) ---
+static int jobs_prepare(whisper_jobs_t* jobs, struct whisper_full_params* params) {
+    if (!jobs || !params) return -1;
+    for (int j = 0; j < jobs->n_jobs; j++) job_clear(&jobs->jobs[j]);
+    jobs->params = *params;
+    if (jobs->n_threads > 0) jobs->params.n_threads = jobs->n_threads;
+    jobs->next_job = 0;
+    memset(jobs->stats, 0, sizeof(jobs->stats));
+    return 0;
+}
 
-typedef struct {
-    float* data;
-    int count;
-} wav_samples_t;
+static int jobs_failed(whisper_jobs_t* jobs) {
+    int failed = 0;
+    for (int j = 0; j < jobs->n_jobs; j++) {
+        if (jobs->jobs[j].rc != 0) failed++;
+    }
+    return failed;
+}
 
-static wav_samples_t* g_last_samples = NULL;
+// Run every queued job with `params` and wait for all of them. Returns the
+// number of failed jobs.
+int32_t whisper_jobs_run(whisper_jobs_t* jobs, struct whisper_full_params* params) {
+    if (jobs_prepare(jobs, params) != 0) return -1;
+    if (jobs_run_workers(jobs, job_worker_main) != 0) return -1;
+    return jobs_failed(jobs);
+}
 
-wav_samples_t* whisper_load_wav(moonbit_bytes_t wav_path) {
-    char* path = bytes_to_cstring(wav_path);
-    FILE* f = fopen(path, "rb");
-    free(path);
-    if (!f) return NULL;
+// Ask the kernel to start reading a file we are about to decode.
+static void file_prefetch(const char* path) {
+#if defined(POSIX_FADV_WILLNEED)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
 
-    // Read WAV header
-    char riff[4];
-    if (fread(riff, 1, 4, f) != 4 || memcmp(riff, "RIFF", 4) != 0) {
-        fclose(f);
-        return NULL;
+static void* job_loader_main(void* arg) {
+    whisper_jobs_t* jobs = (whisper_jobs_t*)arg;
+    for (int j = 0; j < jobs->n_jobs; j++) {
+        double t0 = now_ms();
+        pthread_mutex_lock(&jobs->lock);
+        while (j - jobs->next_job >= jobs->depth) pthread_cond_wait(&jobs->space, &jobs->lock);
+        pthread_mutex_unlock(&jobs->lock);
+        double t1 = now_ms();
+        jobs->stats[JOBS_STAT_LOAD_WAIT] += t1 - t0;
+        whisper_job_t* job = &jobs->jobs[j];
+        if (j + 1 < jobs->n_jobs && jobs->jobs[j + 1].path) file_prefetch(jobs->jobs[j + 1].path);
+        if (job->path) job->loaded = job_load(job);
+        jobs->stats[JOBS_STAT_LOAD_BUSY] += now_ms() - t1;
+        pthread_mutex_lock(&jobs->lock);
+        jobs->n_loaded = j + 1;
+        pthread_cond_broadcast(&jobs->ready);
+        pthread_mutex_unlock(&jobs->lock);
     }
+    pthread_mutex_lock(&jobs->lock);
+    jobs->loader_done = 1;
+    pthread_cond_broadcast(&jobs->ready);
+    pthread_mutex_unlock(&jobs->lock);
+    return NULL;
+}
 
-    uint32_t file_size;
-    fread(&file_size, 4, 1, f);
+static void* job_pipeline_worker_main(void* arg) {
+    job_worker_t* w = (job_worker_t*)arg;
+    whisper_jobs_t* jobs = w->jobs;
+    while (1) {
+        double t0 = now_ms();
+        pthread_mutex_lock(&jobs->lock);
+        while (jobs->next_job >= jobs->n_loaded && !jobs->loader_done) pthread_cond_wait(&jobs->ready, &jobs->lock);
+        int j = jobs->next_job < jobs->n_loaded ? jobs->next_job++ : -1;
+        pthread_cond_signal(&jobs->space);
+        pthread_mutex_unlock(&jobs->lock);
+        double t1 = now_ms();
+        w->wait_ms += t1 - t0;
+        if (j < 0) break;
+        whisper_job_t* job = &jobs->jobs[j];
+        if (job->path) {
+            wav_samples_t* samples = job->loaded;
+            job->loaded = NULL;
+            job_run_samples(jobs, w->state, job, samples);
+        } else {
+            job_run_data(jobs, w->state, job);
+        }
+        w->busy_ms += now_ms() - t1;
+    }
+    return NULL;
+}
 
-    char wave[4];
-    if (fread(wave, 1, 4, f) != 4 || memcmp(wave, "WAVE", 4) != 0) {
-        fclose(f);
-        return NULL;
+// whisper_jobs_run with file jobs decoded by a loader thread while the
+// workers transcribe: the loader works through the jobs in order, keeps at
+// most `depth` decoded jobs queued ahead of the workers (so at most depth +
+// n_workers decoded files are alive) and prefetches the file after the one
+// it is decoding. Falls back to whisper_jobs_run if the loader thread cannot
+// be started.
+int32_t whisper_jobs_run_pipelined(whisper_jobs_t* jobs, struct whisper_full_params* params, int32_t depth) {
+    if (jobs_prepare(jobs, params) != 0) return -1;
+    jobs->depth = depth > 0 ? depth : 1;
+    jobs->n_loaded = 0;
+    jobs->loader_done = 0;
+    pthread_t loader;
+    if (pthread_create(&loader, NULL, job_loader_main, jobs) != 0) {
+        return whisper_jobs_run(jobs, params);
+    }
+    int rc = jobs_run_workers(jobs, job_pipeline_worker_main);
+    if (rc != 0) {
+        // no workers: let the loader finish, then drop what it decoded
+        pthread_mutex_lock(&jobs->lock);
+        jobs->next_job = jobs->n_jobs;
+        pthread_cond_broadcast(&jobs->space);
+        pthread_mutex_unlock(&jobs->lock);
     }
+    pthread_join(loader, NULL);
+    for (int j = 0; j < jobs->n_jobs; j++) {
+        whisper_samples_free(jobs->jobs[j].loaded);
+        jobs->jobs[j].loaded = NULL;
+    }
+    return rc != 0 ? -1 : jobs_failed(jobs);
+}
 
-    // Find fmt chunk
-    int16_t audio_format = 0;
-    int16_t num_channels = 0;
-    int32_t sample_rate = 0;
-    int16_t bits_per_sample = 0;
+// Stage time of the last run in ms: 0 wall clock, 1 loader busy, 2 loader
+// blocked on a full queue, 3 workers busy and 4 workers blocked on an empty
+// queue (both summed over workers). Loader figures are 0 unless pipelined.
+double whisper_jobs_stat(whisper_jobs_t* jobs, int32_t which) {
+    if (!jobs || which < 0 || which >= JOBS_STAT_COUNT) return 0.0;
+    return jobs->stats[which];
+}
 
-    while (1) {
-        char chunk_id[4];
-        uint32_t chunk_size;
-        if (fread(chunk_id, 1, 4, f) != 4) { fclose(f); return NULL; }
-        if (fread(&chunk_size, 4, 1, f) != 1) { fclose(f); return NULL; }
-
-        if (memcmp(chunk_id, "fmt ", 4) == 0) {
-            fread(&audio_format, 2, 1, f);
-            fread(&num_channels, 2, 1, f);
-            fread(&sample_rate, 4, 1, f);
-            // skip byte_rate(4) + block_align(2)
-            fseek(f, 6, SEEK_CUR);
-            fread(&bits_per_sample, 2, 1, f);
-            // skip remaining fmt data
-            if (chunk_size > 16) {
-                fseek(f, chunk_size - 16, SEEK_CUR);
-            }
-        } else if (memcmp(chunk_id, "data", 4) == 0) {
-            // Found data chunk
-            if (audio_format != 1 || bits_per_sample != 16) {
-                // Only support PCM 16-bit
-                fclose(f);
-                return NULL;
-            }
+// Workers the last run used.
+int32_t whisper_jobs_n_active_workers(whisper_jobs_t* jobs) {
+    if (!jobs) return 0;
+    return jobs->n_workers < jobs->n_jobs ? jobs->n_workers : jobs->n_jobs;
+}
 
-            int num_samples = chunk_size / (bits_per_sample / 8) / num_channels;
-
-            // Read raw samples
-            int16_t* raw = (int16_t*)malloc(num_samples * num_channels * sizeof(int16_t));
-            fread(raw, sizeof(int16_t), num_samples * num_channels, f);
-
-            // Convert to mono float32
-            float* mono = (float*)malloc(num_samples * sizeof(float));
-            for (int i = 0; i < num_samples; i++) {
-                if (num_channels == 1) {
-                    mono[i] = (float)raw[i] / 32768.0f;
-                } else {
-                    // Mix channels to mono
-                    float sum = 0.0f;
-                    for (int c = 0; c < num_channels; c++) {
-                        sum += (float)raw[i * num_channels + c] / 32768.0f;
-                    }
-                    mono[i] = sum / num_channels;
-                }
-            }
-            free(raw);
-
-            // Resample to 16kHz if needed
-            float* output = mono;
-            int output_count = num_samples;
-
-            if (sample_rate != 16000 && sample_rate > 0) {
-                output_count = (int)((int64_t)num_samples * 16000 / sample_rate);
-                output = (float*)malloc(output_count * sizeof(float));
-                for (int i = 0; i < output_count; i++) {
-                    float src_idx = (float)i * sample_rate / 16000.0f;
-                    int idx0 = (int)src_idx;
-                    float frac = src_idx - idx0;
-                    if (idx0 + 1 < num_samples) {
-                        output[i] = mono[idx0] * (1.0f - frac) + mono[idx0 + 1] * frac;
-                    } else if (idx0 < num_samples) {
-                        output[i] = mono[idx0];
-                    } else {
-                        output[i] = 0.0f;
-                    }
-                }
-                free(mono);
-            }
+static whisper_job_t* jobs_get(whisper_jobs_t* jobs, int32_t j) {
+    return jobs && j >= 0 && j < jobs->n_jobs ? &jobs->jobs[j] : NULL;
+}
 
-            wav_samples_t* result = (wav_samples_t*)malloc(sizeof(wav_samples_t));
-            result->data = output;
-            result->count = output_count;
-            fclose(f);
-            return result;
-        } else {
-            // Skip unknown chunk
-            fseek(f, chunk_size, SEEK_CUR);
-        }
+static job_segment_t* jobs_segment(whisper_jobs_t* jobs, int32_t j, int32_t i) {
+    whisper_job_t* job = jobs_get(jobs, j);
+    return job && i >= 0 && i < job->n_segs ? &job->segs[i] : NULL;
+}
+
+int32_t whisper_jobs_rc(whisper_jobs_t* jobs, int32_t j) {
+    whisper_job_t* job = jobs_get(jobs, j);
+    return job ? job->rc : -1;
+}
+
+// 1 if a file job's audio could not be loaded.
+int32_t whisper_jobs_load_failed(whisper_jobs_t* jobs, int32_t j) {
+    whisper_job_t* job = jobs_get(jobs, j);
+    return job && job->load_failed ? 1 : 0;
+}
+
+// Start of a file job's decoded window on the file's 16kHz timeline.
+int32_t whisper_jobs_origin(whisper_jobs_t* jobs, int32_t j) {
+    whisper_job_t* job = jobs_get(jobs, j);
+    return job ? job->origin : 0;
+}
+
+int32_t whisper_jobs_lang_id(whisper_jobs_t* jobs, int32_t j) {
+    whisper_job_t* job = jobs_get(jobs, j);
+    return job ? job->lang_id : -1;
+}
+
+int32_t whisper_jobs_n_segments(whisper_jobs_t* jobs, int32_t j) {
+    whisper_job_t* job = jobs_get(jobs, j);
+    return job ? job->n_segs : 0;
+}
+
+moonbit_bytes_t whisper_jobs_segment_text(whisper_jobs_t* jobs, int32_t j, int32_t i) {
+    job_segment_t* seg = jobs_segment(jobs, j, i);
+    return cstring_to_bytes(seg ? seg->text : NULL);
+}
+
+int64_t whisper_jobs_segment_t0(whisper_jobs_t* jobs, int32_t j, int32_t i) {
+    job_segment_t* seg = jobs_segment(jobs, j, i);
+    return seg ? seg->t0 : 0;
+}
+
+int64_t whisper_jobs_segment_t1(whisper_jobs_t* jobs, int32_t j, int32_t i) {
+    job_segment_t* seg = jobs_segment(jobs, j, i);
+    return seg ? seg->t1 : 0;
+}
+
+double whisper_jobs_segment_no_speech_prob(whisper_jobs_t* jobs, int32_t j, int32_t i) {
+    job_segment_t* seg = jobs_segment(jobs, j, i);
+    return seg ? seg->no_speech_prob : 0.0;
+}
+
+int32_t whisper_jobs_segment_speaker_turn(whisper_jobs_t* jobs, int32_t j, int32_t i) {
+    job_segment_t* seg = jobs_segment(jobs, j, i);
+    return seg && seg->speaker_turn_next ? 1 : 0;
+}
+
+// --- Explicit whisper states ---
+//
+// A whisper_state holds everything one inference mutates (KV caches, mel,
+// results); the context only holds the read-only weights. Each state may be
+// driven from its own thread, so N states on one context run N transcriptions
+// at once with a single copy of the model.
+
+struct whisper_state* whisper_state_init(struct whisper_context* ctx) {
+    return ctx ? whisper_init_state(ctx) : NULL;
+}
+
+int32_t whisper_state_is_null(struct whisper_state* state) {
+    return state == NULL ? 1 : 0;
+}
+
+void whisper_state_free(struct whisper_state* state) {
+    if (state != NULL) {
+        whisper_free_state(state);
     }
+}
 
-    fclose(f);
-    return NULL;
+int32_t whisper_state_run_full_range(struct whisper_context* ctx, struct whisper_state* state, struct whisper_full_params* params, wav_samples_t* samples, int32_t offset, int32_t count) {
+    if (!ctx || !state || !params || !samples_range_ok(samples, offset, count)) return -1;
+    return whisper_full_with_state(ctx, state, *params, samples->data + offset, count);
 }
 
-int32_t whisper_samples_count(wav_samples_t* s) {
-    return s ? s->count : 0;
+int32_t whisper_state_run_full_pcm_range(struct whisper_context* ctx, struct whisper_state* state, struct whisper_full_params* params, float* pcm, int32_t offset, int32_t count) {
+    if (!ctx || !state || !params || !pcm) return -1;
+    int32_t n = Moonbit_array_length(pcm);
+    if (offset < 0 || count < 0 || offset > n || count > n - offset) return -1;
+    return whisper_full_with_state(ctx, state, *params, pcm + offset, count);
 }
 
-int32_t whisper_samples_is_null(wav_samples_t* s) {
-    return s == NULL ? 1 : 0;
+int32_t whisper_state_n_segments(struct whisper_state* state) {
+    return whisper_full_n_segments_from_state(state);
 }
 
-void whisper_samples_free(wav_samples_t* s) {
-    if (s) {
-        if (s->data) free(s->data);
-        free(s);
+moonbit_bytes_t whisper_state_segment_text(struct whisper_state* state, int32_t i) {
+    return cstring_to_bytes(whisper_full_get_segment_text_from_state(state, i));
+}
+
+int64_t whisper_state_segment_t0(struct whisper_state* state, int32_t i) {
+    return whisper_full_get_segment_t0_from_state(state, i);
+}
+
+int64_t whisper_state_segment_t1(struct whisper_state* state, int32_t i) {
+    return whisper_full_get_segment_t1_from_state(state, i);
+}
+
+double whisper_state_segment_no_speech_prob(struct whisper_state* state, int32_t i) {
+    return (double)whisper_full_get_segment_no_speech_prob_from_state(state, i);
+}
+
+int32_t whisper_state_segment_speaker_turn(struct whisper_state* state, int32_t i) {
+    return whisper_full_get_segment_speaker_turn_next_from_state(state, i) ? 1 : 0;
+}
+
+int32_t whisper_state_lang_id(struct whisper_state* state) {
+    return whisper_full_lang_id_from_state(state);
+}
+
+int32_t whisper_state_n_tokens(struct whisper_state* state, int32_t i_segment) {
+    return whisper_full_n_tokens_from_state(state, i_segment);
+}
+
+moonbit_bytes_t whisper_state_token_text(struct whisper_context* ctx, struct whisper_state* state, int32_t i_segment, int32_t i_token) {
+    return cstring_to_bytes(whisper_full_get_token_text_from_state(ctx, state, i_segment, i_token));
+}
+
+int32_t whisper_state_token_id(struct whisper_state* state, int32_t i_segment, int32_t i_token) {
+    return (int32_t)whisper_full_get_token_id_from_state(state, i_segment, i_token);
+}
+
+double whisper_state_token_prob(struct whisper_state* state, int32_t i_segment, int32_t i_token) {
+    return (double)whisper_full_get_token_p_from_state(state, i_segment, i_token);
+}
+
+int64_t whisper_state_token_t0(struct whisper_state* state, int32_t i_segment, int32_t i_token) {
+    return whisper_full_get_token_data_from_state(state, i_segment, i_token).t0;
+}
+
+int64_t whisper_state_token_t1(struct whisper_state* state, int32_t i_segment, int32_t i_token) {
+    return whisper_full_get_token_data_from_state(state, i_segment, i_token).t1;
+}
+
+// whisper_ctx_lang_auto_detect_range on a state.
+int32_t whisper_state_lang_auto_detect_range(struct whisper_context* ctx, struct whisper_state* state, wav_samples_t* samples, int32_t offset, int32_t count, int32_t n_threads, double* probs_out) {
+    if (!ctx || !state || !samples_range_ok(samples, offset, count)) return -1;
+    if (whisper_pcm_to_mel_with_state(ctx, state, samples->data + offset, count, n_threads) != 0) return -1;
+    int n_langs = whisper_lang_max_id() + 1;
+    float* probs = (float*)malloc(n_langs * sizeof(float));
+    if (!probs) return -1;
+    int lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, n_threads, probs);
+    if (probs_out) {
+        int out_len = Moonbit_array_length(probs_out);
+        int copy_len = out_len < n_langs ? out_len : n_langs;
+        for (int i = 0; i < copy_len; i++) {
+            probs_out[i] = (double)probs[i];
+        }
     }
+    free(probs);
+    return lang_id;
 }
 
-// --- Inference ---
+// --- Warmup ---
+//
+// One whisper_full pass over a second of silence plus a one-token decode, so
+// the first real request does not pay for allocating the state's compute
+// buffers and KV caches, building the graphs and pulling the weights into
+// memory and caches. The mel is padded, so the encoder runs over audio_ctx
+// frames: the full 30s window when audio_ctx is 0, the same reduced context
+// as real requests otherwise. Runs on `state`, or on the context's default state when
+// NULL. Returns the pass duration in ms, or -1 on failure.
+static double warmup_run(struct whisper_context* ctx, struct whisper_state* state, int32_t n_threads, int32_t audio_ctx) {
+    if (!ctx) return -1.0;
+    const int n_samples = 16000;  // 1s; the mel is padded to audio_ctx frames
+    float* pcm = (float*)calloc((size_t)n_samples, sizeof(float));
+    if (!pcm) return -1.0;
+    struct whisper_full_params p = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    p.n_threads = n_threads > 0 ? n_threads : p.n_threads;
+    p.audio_ctx = audio_ctx;
+    p.language = "en";
+    p.no_context = true;
+    p.single_segment = true;
+    p.max_tokens = 1;
+    p.temperature_inc = 0.0f;  // no fallback re-decodes
+    p.print_progress = false;
+    p.print_realtime = false;
+    p.print_special = false;
+    p.print_timestamps = false;
+    double t0 = now_ms();
+    int rc = state ? whisper_full_with_state(ctx, state, p, pcm, n_samples) : whisper_full(ctx, p, pcm, n_samples);
+    double elapsed = now_ms() - t0;
+    free(pcm);
+    if (rc != 0) return -1.0;
+    if (!state) whisper_reset_timings(ctx);  // keep the warmup out of reported timings
+    return elapsed;
+}
 
-int32_t whisper_run_full(struct whisper_context* ctx, struct whisper_full_params* params, wav_samples_t* samples) {
-    if (!ctx || !params || !samples || !samples->data) return -1;
-    return whisper_full(ctx, *params, samples->data, samples->count);
+double whisper_ctx_warmup(struct whisper_context* ctx, int32_t n_threads, int32_t audio_ctx) {
+    return warmup_run(ctx, NULL, n_threads, audio_ctx);
 }
 
-int32_t whisper_run_full_parallel(struct whisper_context* ctx, struct whisper_full_params* params, wav_samples_t* samples, int32_t n_processors) {
-    if (!ctx || !params || !samples || !samples->data) return -1;
-    if (n_processors < 1) n_processors = 1;
-    return whisper_full_parallel(ctx, *params, samples->data, samples->count, n_processors);
+double whisper_state_warmup(struct whisper_context* ctx, struct whisper_state* state, int32_t n_threads, int32_t audio_ctx) {
+    if (!state) return -1.0;
+    return warmup_run(ctx, state, n_threads, audio_ctx);
+}
+
+// --- State memory footprint ---
+//
+// whisper_init_state allocates three f16 KV caches, each padded to a multiple
+// of 256 positions: the decoder self-attention cache over n_text_ctx (grown
+// to n_decoders times that once beam search or best-of needs more decoders),
+// the cross-attention cache over n_audio_ctx and a one-layer padding cache for
+// the encoder's flash attention. Their sizes follow from the hyperparameters.
+// The compute buffers depend on the graphs built for a given audio_ctx and are
+// only known to whisper.cpp, so they are measured instead: as the growth of
+// the process RSS over creating a state and running one warmup pass on it.
+// The cache type and the padding mirror whisper.cpp's whisper_init_state and
+// are not exposed by whisper.h; they have to be kept in step with it.
+
+#define KV_PAD(n) ((((int64_t)(n)) + 255) / 256 * 256)
+
+// which: 0 = self-attention, 1 = cross-attention, 2 = padding cache.
+int64_t whisper_ctx_kv_bytes(struct whisper_context* ctx, int32_t which, int32_t n_decoders) {
+    if (!ctx) return 0;
+    const int64_t f16 = 2;
+    if (n_decoders < 1) n_decoders = 1;
+    switch (which) {
+        case 0:
+            return 2 * f16 * whisper_model_n_text_state(ctx) * whisper_model_n_text_layer(ctx) *
+                   (KV_PAD(whisper_model_n_text_ctx(ctx)) * n_decoders);
+        case 1:
+            return 2 * f16 * whisper_model_n_text_state(ctx) * whisper_model_n_text_layer(ctx) *
+                   KV_PAD(whisper_model_n_audio_ctx(ctx));
+        case 2:
+            return 2 * f16 * whisper_model_n_audio_state(ctx) * KV_PAD(whisper_model_n_audio_ctx(ctx));
+        default: return 0;
+    }
+}
+
+#if defined(__linux__)
+// Resident set size of this process in bytes, or -1 if it cannot be read.
+static int64_t process_rss_bytes(void) {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    long pages_total = 0, pages_rss = 0;
+    int n = fscanf(f, "%ld %ld", &pages_total, &pages_rss);
+    fclose(f);
+    if (n != 2) return -1;
+    return (int64_t)pages_rss * (int64_t)sysconf(_SC_PAGESIZE);
+}
+#endif
+
+// RSS growth over creating a state and running a warmup pass on it with
+// `n_threads` / `audio_ctx`; the state is freed again. Linux only: -1
+// elsewhere, without creating a state, and -1 if the pass fails. It is a
+// process-wide delta, so other threads allocating or freeing meanwhile skew
+// it, and memory freed back to malloc by earlier states can be reused here:
+// run it before creating other states and while nothing else is running.
+int64_t whisper_ctx_measure_state_bytes(struct whisper_context* ctx, int32_t n_threads, int32_t audio_ctx) {
+#if defined(__linux__)
+    int64_t before = process_rss_bytes();
+    if (!ctx || before < 0) return -1;
+    struct whisper_state* state = whisper_init_state(ctx);
+    if (!state) return -1;
+    double ms = warmup_run(ctx, state, n_threads, audio_ctx);
+    int64_t after = process_rss_bytes();
+    whisper_free_state(state);
+    if (ms < 0 || after < 0) return -1;
+    return after > before ? after - before : 0;
+#else
+    (void)ctx;
+    (void)n_threads;
+    (void)audio_ctx;
+    return -1;
+#endif
 }
 
 int32_t whisper_get_n_segments(struct whisper_context* ctx) {
@@ -283,12 +3950,22 @@ void whisper_params_set_audio_ctx(struct whisper_full_params* p, int32_t val) {
 }
 
 void whisper_params_set_initial_prompt(struct whisper_full_params* p, moonbit_bytes_t prompt) {
-    static char prompt_buffer[4096];
-    char* tmp = bytes_to_cstring(prompt);
-    strncpy(prompt_buffer, tmp, sizeof(prompt_buffer) - 1);
-    prompt_buffer[sizeof(prompt_buffer) - 1] = '\0';
-    free(tmp);
-    p->initial_prompt = prompt_buffer;
+    p->initial_prompt = params_set_string(&((params_owned_t*)p)->initial_prompt, bytes_to_cstring(prompt));
+}
+
+// Tokens to condition the next run on (they take precedence over
+// initial_prompt); n <= 0 clears them.
+void whisper_params_set_prompt_tokens(struct whisper_full_params* p, int32_t* tokens, int32_t n) {
+    params_owned_t* o = (params_owned_t*)p;
+    free(o->prompt_tokens);
+    o->prompt_tokens = NULL;
+    if (n > 0) {
+        o->prompt_tokens = (whisper_token*)malloc((size_t)n * sizeof(whisper_token));
+        if (!o->prompt_tokens) n = 0;
+        for (int32_t i = 0; i < n; i++) o->prompt_tokens[i] = tokens[i];
+    }
+    p->prompt_tokens = o->prompt_tokens;
+    p->prompt_n_tokens = n > 0 ? n : 0;
 }
 
 void whisper_params_set_temperature(struct whisper_full_params* p, double val) {
@@ -316,12 +3993,7 @@ void whisper_params_set_vad(struct whisper_full_params* p, int32_t val) {
 }
 
 void whisper_params_set_vad_model_path(struct whisper_full_params* p, moonbit_bytes_t path) {
-    static char vad_path_buffer[4096];
-    char* tmp = bytes_to_cstring(path);
-    strncpy(vad_path_buffer, tmp, sizeof(vad_path_buffer) - 1);
-    vad_path_buffer[sizeof(vad_path_buffer) - 1] = '\0';
-    free(tmp);
-    p->vad_model_path = vad_path_buffer;
+    p->vad_model_path = params_set_string(&((params_owned_t*)p)->vad_model_path, bytes_to_cstring(path));
 }
 
 void whisper_params_set_vad_threshold(struct whisper_full_params* p, double val) {
@@ -344,6 +4016,152 @@ void whisper_params_set_vad_speech_pad_ms(struct whisper_full_params* p, int32_t
     p->vad_params.speech_pad_ms = val;
 }
 
+// Checks of the params ownership rules. Worker threads are native pthreads,
+// so they create and fill params only through the plain C setters above and
+// never touch a MoonBit object.
+
+#define PARAMS_CHECK_MAX_THREADS 8
+
+// Model-free: n_threads threads each own a params object and, iters times,
+// set a language, initial prompt and VAD model path of their own, yield, and
+// check that their params still hold exactly those strings. Returns the
+// number of failed checks.
+
+typedef struct {
+    int id;
+    int iters;
+    int failed;
+} params_strings_job_t;
+
+static void* params_strings_worker(void* arg) {
+    params_strings_job_t* job = (params_strings_job_t*)arg;
+    struct whisper_full_params* p = whisper_params_create();
+    for (int it = 0; it < job->iters; it++) {
+        char lang[16], prompt[64], path[64];
+        snprintf(lang, sizeof(lang), "l%d", job->id);
+        snprintf(prompt, sizeof(prompt), "Thread %d, run %d.", job->id, it);
+        snprintf(path, sizeof(path), "/models/vad-%d-%d.bin", job->id, it);
+        params_set_language_cstr(p, lang);
+        params_set_initial_prompt_cstr(p, prompt);
+        params_set_vad_model_path_cstr(p, path);
+        sched_yield();
+        if (!p->language || !p->initial_prompt || !p->vad_model_path ||
+            strcmp(p->language, lang) != 0 || strcmp(p->initial_prompt, prompt) != 0 ||
+            strcmp(p->vad_model_path, path) != 0) {
+            job->failed++;
+        }
+    }
+    whisper_params_free(p);
+    return NULL;
+}
+
+int32_t whisper_check_params_strings(int32_t n_threads, int32_t iters) {
+    if (n_threads < 1 || iters < 1) return 0;
+    if (n_threads > PARAMS_CHECK_MAX_THREADS) n_threads = PARAMS_CHECK_MAX_THREADS;
+    pthread_t threads[PARAMS_CHECK_MAX_THREADS];
+    params_strings_job_t jobs[PARAMS_CHECK_MAX_THREADS];
+    int started[PARAMS_CHECK_MAX_THREADS] = {0};
+    int failed = 0;
+    for (int t = 0; t < n_threads; t++) {
+        jobs[t] = (params_strings_job_t){ t, iters, 0 };
+        started[t] = pthread_create(&threads[t], NULL, params_strings_worker, &jobs[t]) == 0;
+    }
+    for (int t = 0; t < n_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            jobs[t].failed = iters;
+        }
+        failed += jobs[t].failed;
+    }
+    return failed;
+}
+
+// With a model: n_threads threads share one context, each with its own
+// whisper_state and its own params object. Every thread sets a language and
+// initial prompt of its own before each run, while the others are decoding,
+// and afterwards checks that its params still hold its strings and (on
+// multilingual models) that whisper decoded in its language. Fills out[0]
+// with the number of runs, out[1] with the failed ones and out[2] with the
+// wall time in ms.
+
+typedef struct {
+    struct whisper_context* ctx;
+    const float* pcm;
+    int n_pcm;
+    int id;
+    int iters;
+    int runs;
+    int failed;
+} params_check_job_t;
+
+static void* params_check_worker(void* arg) {
+    params_check_job_t* job = (params_check_job_t*)arg;
+    static const char* langs[PARAMS_CHECK_MAX_THREADS] = { "en", "de", "fr", "ja", "es", "it", "nl", "ko" };
+    const char* lang = langs[job->id];
+    const int multilingual = whisper_is_multilingual(job->ctx);
+    struct whisper_state* state = whisper_init_state(job->ctx);
+    if (!state) {
+        job->failed = job->iters;
+        return NULL;
+    }
+    struct whisper_full_params* p = whisper_params_create();
+    whisper_params_set_n_threads(p, 1);
+    whisper_params_set_single_segment(p, 1);
+    whisper_params_set_max_tokens(p, 8);
+    for (int it = 0; it < job->iters; it++) {
+        char prompt[64];
+        snprintf(prompt, sizeof(prompt), "Thread %d, run %d.", job->id, it);
+        params_set_language_cstr(p, lang);
+        params_set_initial_prompt_cstr(p, prompt);
+        int rc = whisper_full_with_state(job->ctx, state, *p, job->pcm, job->n_pcm);
+        job->runs++;
+        if (rc != 0 || strcmp(p->language, lang) != 0 || strcmp(p->initial_prompt, prompt) != 0 ||
+            (multilingual && whisper_full_lang_id_from_state(state) != whisper_lang_id(lang))) {
+            job->failed++;
+        }
+    }
+    whisper_params_free(p);
+    whisper_free_state(state);
+    return NULL;
+}
+
+void whisper_bench_params_threads(struct whisper_context* ctx, int32_t n_threads, int32_t iters, double* out) {
+    int out_len = Moonbit_array_length(out);
+    if (out_len < 3) return;
+    out[0] = out[1] = out[2] = 0.0;
+    if (!ctx || n_threads < 1 || iters < 1) return;
+    if (n_threads > PARAMS_CHECK_MAX_THREADS) n_threads = PARAMS_CHECK_MAX_THREADS;
+    // 2 s of deterministic low-level noise
+    const int n_pcm = 16000 * 2;
+    float* pcm = (float*)malloc((size_t)n_pcm * sizeof(float));
+    if (!pcm) return;
+    uint32_t seed = 12345;
+    for (int i = 0; i < n_pcm; i++) {
+        seed = seed * 1103515245u + 12345u;
+        pcm[i] = (float)((seed >> 16) & 0x7fff) / 327680.0f - 0.05f;
+    }
+    pthread_t threads[PARAMS_CHECK_MAX_THREADS];
+    params_check_job_t jobs[PARAMS_CHECK_MAX_THREADS];
+    int started[PARAMS_CHECK_MAX_THREADS] = {0};
+    double t0 = now_ms();
+    for (int t = 0; t < n_threads; t++) {
+        jobs[t] = (params_check_job_t){ ctx, pcm, n_pcm, t, iters, 0, 0 };
+        started[t] = pthread_create(&threads[t], NULL, params_check_worker, &jobs[t]) == 0;
+    }
+    for (int t = 0; t < n_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            jobs[t].failed = iters;
+        }
+        out[0] += jobs[t].runs;
+        out[1] += jobs[t].failed;
+    }
+    out[2] = now_ms() - t0;
+    free(pcm);
+}
+
 // --- Group 2: Model info / metadata ---
 
 int32_t whisper_ctx_is_multilingual(struct whisper_context* ctx) {
@@ -367,6 +4185,17 @@ moonbit_bytes_t whisper_ctx_model_type(struct whisper_context* ctx) {
     return cstring_to_bytes(s);
 }
 
+int32_t whisper_ctx_model_ftype(struct whisper_context* ctx) {
+    return whisper_model_ftype(ctx);
+}
+
+// ggml type of the bulk of the weights for the model's ftype, or -1 for an
+// ftype ggml does not know.
+int32_t whisper_ctx_model_wtype(struct whisper_context* ctx) {
+    int t = (int)ggml_ftype_to_ggml_type((enum ggml_ftype)whisper_model_ftype(ctx));
+    return t < 0 || t >= GGML_TYPE_COUNT ? -1 : t;
+}
+
 int32_t whisper_ctx_lang_max_id(void) {
     return whisper_lang_max_id();
 }
@@ -473,6 +4302,11 @@ int32_t whisper_ctx_token_count(struct whisper_context* ctx, moonbit_bytes_t tex
     return count;
 }
 
+// Ids from this one up are special (timestamps, language, task) tokens.
+int32_t whisper_ctx_token_eot(struct whisper_context* ctx) {
+    return whisper_token_eot(ctx);
+}
+
 // Returns a MoonBit FixedArray[Int] of token IDs.
 // On error, returns an empty array.
 int32_t* whisper_ctx_tokenize(struct whisper_context* ctx, moonbit_bytes_t text, int32_t max_tokens) {
@@ -505,37 +4339,51 @@ moonbit_bytes_t whisper_ctx_lang_str_full(int32_t id) {
     return cstring_to_bytes(s);
 }
 
-// Convenience: load WAV -> pcm_to_mel -> lang_auto_detect
+// Convenience: pcm_to_mel -> lang_auto_detect on samples[offset, offset + count)
 // Returns detected language id, or -1 on error.
-// Also fills probs array if non-null.
-int32_t whisper_ctx_lang_auto_detect(struct whisper_context* ctx, wav_samples_t* samples, int32_t offset_ms, int32_t n_threads) {
-    if (!ctx || !samples || !samples->data) return -1;
-    int rc = whisper_pcm_to_mel(ctx, samples->data, samples->count, n_threads);
+// Also fills probs_out (a MoonBit FixedArray[Double]) if non-null.
+int32_t whisper_ctx_lang_auto_detect_range(struct whisper_context* ctx, wav_samples_t* samples, int32_t offset, int32_t count, int32_t offset_ms, int32_t n_threads, double* probs_out) {
+    if (!ctx || !samples_range_ok(samples, offset, count)) return -1;
+    int rc = whisper_pcm_to_mel(ctx, samples->data + offset, count, n_threads);
     if (rc != 0) return -1;
     int n_langs = whisper_lang_max_id() + 1;
     float* probs = (float*)malloc(n_langs * sizeof(float));
     int lang_id = whisper_lang_auto_detect(ctx, offset_ms, n_threads, probs);
+    if (probs_out) {
+        int out_len = Moonbit_array_length(probs_out);
+        int copy_len = out_len < n_langs ? out_len : n_langs;
+        for (int i = 0; i < copy_len; i++) {
+            probs_out[i] = (double)probs[i];
+        }
+    }
     free(probs);
     return lang_id;
 }
 
+int32_t whisper_ctx_lang_auto_detect(struct whisper_context* ctx, wav_samples_t* samples, int32_t offset_ms, int32_t n_threads) {
+    return whisper_ctx_lang_auto_detect_range(ctx, samples, 0, samples ? samples->count : 0, offset_ms, n_threads, NULL);
+}
+
 // Same as above but also returns probabilities for all languages.
 // Returns detected language id. probs_out is filled with (lang_max_id+1) doubles.
 // Caller provides a MoonBit FixedArray[Double] of appropriate size.
 int32_t whisper_ctx_lang_auto_detect_with_probs(struct whisper_context* ctx, wav_samples_t* samples, int32_t offset_ms, int32_t n_threads, double* probs_out) {
-    if (!ctx || !samples || !samples->data) return -1;
-    int rc = whisper_pcm_to_mel(ctx, samples->data, samples->count, n_threads);
-    if (rc != 0) return -1;
-    int n_langs = whisper_lang_max_id() + 1;
-    float* probs = (float*)malloc(n_langs * sizeof(float));
-    int lang_id = whisper_lang_auto_detect(ctx, offset_ms, n_threads, probs);
-    int out_len = Moonbit_array_length(probs_out);
-    int copy_len = out_len < n_langs ? out_len : n_langs;
-    for (int i = 0; i < copy_len; i++) {
-        probs_out[i] = (double)probs[i];
+    return whisper_ctx_lang_auto_detect_range(ctx, samples, 0, samples ? samples->count : 0, offset_ms, n_threads, probs_out);
+}
+
+// --- Clock ---
+
+double whisper_clock_ms(void) {
+    return now_ms();
+}
+
+void whisper_sleep_ms(double ms) {
+    if (ms <= 0) return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ms / 1000.0);
+    ts.tv_nsec = (long)((ms - (double)ts.tv_sec * 1000.0) * 1e6);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
     }
-    free(probs);
-    return lang_id;
 }
 
 // --- Environment variable access ---